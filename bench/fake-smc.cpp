@@ -0,0 +1,166 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "fake-smc.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+struct FakeKey {
+	uint32_t dataType;
+	uint8_t dataSize;
+};
+
+// Every type the library knows about, and a few it does not (so the NAN paths are exercised too).
+static const FakeKey fakeTypes[] = {
+	{DATATYPE_FP1F_KEY, 2}, {DATATYPE_FP4C_KEY, 2}, {DATATYPE_FP5B_KEY, 2}, {DATATYPE_FP6A_KEY, 2}, {DATATYPE_FP79_KEY, 2},
+	{DATATYPE_FP88_KEY, 2}, {DATATYPE_FPA6_KEY, 2}, {DATATYPE_FPC4_KEY, 2}, {DATATYPE_FPE2_KEY, 2},
+	{DATATYPE_SP1E_KEY, 2}, {DATATYPE_SP3C_KEY, 2}, {DATATYPE_SP4B_KEY, 2}, {DATATYPE_SP5A_KEY, 2}, {DATATYPE_SP69_KEY, 2},
+	{DATATYPE_SP78_KEY, 2}, {DATATYPE_SP87_KEY, 2}, {DATATYPE_SP96_KEY, 2}, {DATATYPE_SPB4_KEY, 2}, {DATATYPE_SPF0_KEY, 2},
+	{DATATYPE_UINT8_KEY, 1}, {DATATYPE_UINT16_KEY, 2}, {DATATYPE_UINT32_KEY, 4}, {DATATYPE_UINT64_KEY, 8},
+	{DATATYPE_SI8_KEY, 1}, {DATATYPE_SI16_KEY, 2}, {DATATYPE_SI32_KEY, 4}, {DATATYPE_SI64_KEY, 8},
+	{DATATYPE_PWM_KEY, 2}, {DATATYPE_FLAG_KEY, 1},
+	{DATATYPE_HEX_KEY, 1}, {DATATYPE_HEX_KEY, 2}, {DATATYPE_HEX_KEY, 4}, {DATATYPE_HEX_KEY, 8},
+	{DATATYPE_FLT_KEY, 4}, {DATATYPE_IOFT_KEY, 8},
+	{DATATYPE_CH8_KEY, 16}, {DATATYPE_FDS_KEY, 16}, {DATATYPE_REV_KEY, 6}, {DATATYPE_LIM_KEY, 8},
+	{DATATYPE_ALC_KEY, 10}, {DATATYPE_ALV_KEY, 10}, {DATATYPE_HDI_KEY, 16}
+};
+
+static std::vector<std::string> keyNames;
+static std::vector<uint32_t> keyCodes;                      // Index order, as reported by SMC_CMD_READ_INDEX ("#KEY" is last).
+static std::unordered_map<uint32_t, FakeKey> keyTable;
+static uint64_t latencyNs;
+static std::atomic<uint64_t> calls(0);
+static std::atomic<uint32_t> ticker(0);
+
+// See header for documentation
+void FakeSMCConfigure(size_t keyCount, uint64_t callLatencyNs) {
+	static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	const size_t radix = sizeof(alphabet) - 1;
+	keyNames.clear();
+	keyCodes.clear();
+	keyTable.clear();
+	latencyNs = callLatencyNs;
+	keyCount = std::min(keyCount, radix * radix * radix);
+	for (size_t i = 0; i < keyCount; i++) {
+		char name[5] = {'Z', alphabet[(i / (radix * radix)) % radix], alphabet[(i / radix) % radix], alphabet[i % radix], 0};
+		keyNames.emplace_back(name);
+		keyCodes.push_back(stringToKey(name));
+		keyTable[keyCodes.back()] = fakeTypes[i % (sizeof(fakeTypes) / sizeof(fakeTypes[0]))];
+	}
+	keyCodes.push_back(stringToKey("#KEY"));
+	keyTable[keyCodes.back()] = FakeKey{DATATYPE_UINT32_KEY, 4};
+}
+
+// See header for documentation
+const std::vector<std::string>& FakeSMCKeys() {
+	return keyNames;
+}
+
+// See header for documentation
+uint64_t FakeSMCCalls() {
+	return calls.load(std::memory_order_relaxed);
+}
+
+/**
+ * Model the cost of a kernel round trip by burning CPU (sleeping would let other consumers run, which is not what the kernel does).
+ */
+static void spin() {
+	calls.fetch_add(1, std::memory_order_relaxed);
+	if (latencyNs == 0)
+		return;
+	auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(latencyNs);
+	while (std::chrono::steady_clock::now() < until);
+}
+
+extern "C" {
+
+CFMutableDictionaryRef FakeSMCServiceMatching(const char* name) {
+	static int dummy;
+	return reinterpret_cast<CFMutableDictionaryRef>(&dummy);
+}
+
+kern_return_t FakeSMCGetMatchingServices(mach_port_t masterPort, CFDictionaryRef matching, io_iterator_t* existing) {
+	spin();
+	*existing = 1;
+	return kIOReturnSuccess;
+}
+
+io_object_t FakeSMCIteratorNext(io_iterator_t iterator) {
+	return 2;
+}
+
+kern_return_t FakeSMCObjectRelease(io_object_t object) {
+	return kIOReturnSuccess;
+}
+
+kern_return_t FakeSMCServiceOpen(io_service_t service, task_port_t owningTask, uint32_t type, io_connect_t* connect) {
+	spin();
+	*connect = 3;
+	return kIOReturnSuccess;
+}
+
+kern_return_t FakeSMCServiceClose(io_connect_t connect) {
+	return kIOReturnSuccess;
+}
+
+kern_return_t FakeSMCCallStructMethod(mach_port_t connection, uint32_t selector, const void* inputStruct, size_t inputStructCnt, void* outputStruct, size_t* outputStructCnt) {
+	spin();
+	if (connection == 0 || selector != KERNEL_INDEX_SMC || inputStructCnt != sizeof(SMCKeyData) || *outputStructCnt < sizeof(SMCKeyData))
+		return kIOReturnBadArgument;
+	const SMCKeyData* in = static_cast<const SMCKeyData*>(inputStruct);
+	SMCKeyData* out = static_cast<SMCKeyData*>(outputStruct);
+	if (in->data8 == SMC_CMD_READ_INDEX) {
+		if (in->data32 >= keyCodes.size())
+			return kIOReturnBadArgument;
+		out->key = keyCodes[in->data32];
+		return kIOReturnSuccess;
+	}
+	auto found = keyTable.find(in->key);
+	if (found == keyTable.end())
+		return kIOReturnNotFound;
+	if (in->data8 == SMC_CMD_READ_KEYINFO) {
+		out->keyInfo.dataType = found->second.dataType;
+		out->keyInfo.dataSize = found->second.dataSize;
+		out->keyInfo.dataAttributes = 0;
+		return kIOReturnSuccess;
+	}
+	if (in->data8 != SMC_CMD_READ_BYTES)
+		return kIOReturnUnsupported;
+	if (in->key == keyCodes.back()) {
+		uint32_t count = htonl(static_cast<uint32_t>(keyCodes.size()));
+		memcpy(out->bytes, &count, sizeof(count));
+		return kIOReturnSuccess;
+	}
+	// Values drift over time, so that consumers which look for changes actually see some.
+	uint32_t t = ticker.fetch_add(1, std::memory_order_relaxed);
+	for (uint8_t i = 0; i < found->second.dataSize && i < sizeof(out->bytes); i++)
+		out->bytes[i] = static_cast<uint8_t>((in->key >> ((i % 4) * 8)) + (i == found->second.dataSize - 1 ? (t >> 8) & 0x0F : 0));
+	return kIOReturnSuccess;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * An in-process stand in for the AppleSMC driver, used by the benchmark.
+ * The benchmark target compiles the library with the IOKit entry points it uses #defined to the functions below (see CMakeLists.txt),
+ * so the library code being measured is exactly the code that ships; only the kernel is fake.
+ */
+#ifndef FAKE_SMC_H
+#define FAKE_SMC_H
+
+#include "smc-read.h"
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CFMutableDictionaryRef FakeSMCServiceMatching(const char* name);
+kern_return_t FakeSMCGetMatchingServices(mach_port_t masterPort, CFDictionaryRef matching, io_iterator_t* existing);
+io_object_t FakeSMCIteratorNext(io_iterator_t iterator);
+kern_return_t FakeSMCObjectRelease(io_object_t object);
+kern_return_t FakeSMCServiceOpen(io_service_t service, task_port_t owningTask, uint32_t type, io_connect_t* connect);
+kern_return_t FakeSMCServiceClose(io_connect_t connect);
+kern_return_t FakeSMCCallStructMethod(mach_port_t connection, uint32_t selector, const void* inputStruct, size_t inputStructCnt, void* outputStruct, size_t* outputStructCnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * (Re)populate the fake SMC with 'keyCount' synthetic keys, cycling through every DATATYPE_* at its real size (hex_ at each of its numeric sizes).
+ * Every call into the fake will spin for 'callLatencyNs' to model the cost of a trip into the kernel.
+ * Must be called before any reader is created.
+ */
+void FakeSMCConfigure(size_t keyCount, uint64_t callLatencyNs);
+
+/**
+ * Names of all the synthetic keys (not including "#KEY").
+ */
+const std::vector<std::string>& FakeSMCKeys();
+
+/**
+ * Total number of calls made into the fake driver.
+ */
+uint64_t FakeSMCCalls();
+
+#endif // FAKE_SMC_H
@@ -0,0 +1,280 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * Scale and soak benchmark.
+ * Drives AppleSMCReader (allKeyValues / allValues, readValue, readBurst, readNumber and the typed reads) from many consumer threads against the fake SMC in fake-smc.cpp,
+ * reporting throughput, tail latency, RSS and heap allocations at every reporting interval for as long as you care to run it.
+ */
+#include "fake-smc.h"
+#include "apple-smc-reader.h"
+#include "apple-smc-histogram.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sys/resource.h>
+#include <thread>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+// Every heap allocation in the process is counted, so that leaks (or unexpected per-read allocations) show up as growth over time.
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> frees(0);
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	if (p != nullptr)
+		frees.fetch_add(1, std::memory_order_relaxed);
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+/**
+ * Latency histogram (@see AppleSMCHistogram for the bucket layout).  Lock free, so the reporter can read while consumers record.
+ */
+class LatencyHistogram {
+public:
+	void record(uint64_t ns) {
+		this->buckets[AppleSMCHistogram::bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void mergeInto(uint64_t* totals) const {
+		for (size_t i = 0; i < AppleSMCHistogram::BUCKETS; i++)
+			totals[i] += this->buckets[i].load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> buckets[AppleSMCHistogram::BUCKETS] = {};
+};
+
+struct Consumer {
+	std::thread thread;
+	LatencyHistogram latency;
+	std::atomic<uint64_t> ops{0};
+	std::atomic<uint64_t> errors{0};
+};
+
+static const char* getCmdOption(const char** begin, const char** end, const std::string& option) {
+	const char** itr = std::find(begin, end, option);
+	if (itr != end && ++itr != end)
+		return *itr;
+	return nullptr;
+}
+
+static long optionOr(int argc, const char* argv[], const char* option, long defaultValue) {
+	const char* value = getCmdOption(argv + 1, argv + argc, option);
+	return value ? strtol(value, nullptr, 10) : defaultValue;
+}
+
+static uint64_t residentBytes() {
+#ifdef __APPLE__
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+		return info.resident_size;
+	return 0;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;   // Peak, but that is as good as it gets portably.
+#endif
+}
+
+// Keys per readBurst, as a typical --snapshot group.
+#define BURST_KEYS 8
+
+/**
+ * One consumer: mostly single key reads spread over the whole key space (through readValue, the heap free path the CLI uses, and readNumber),
+ * a share of typed reads, a share of snapshot bursts over a fixed group of keys, and an occasional full dump (alternately allKeyValues and allValues).
+ */
+static void consume(Consumer& self, const std::atomic<bool>& running, long dumpEvery, unsigned int seed) {
+	AppleSMCReader smc;
+	const auto& keys = FakeSMCKeys();
+	uint32_t rnd = seed * 2654435761u + 1;
+	uint64_t n = 0;
+	// Everything the loop needs is set up here, so that anything allocated per operation shows up in allocs/op.
+	std::vector<uint32_t> codes;
+	codes.reserve(keys.size());
+	for (auto& key : keys)
+		codes.push_back(stringToKey(key.c_str()));
+	uint32_t burstKeys[BURST_KEYS];
+	SMCKeyMetaData burstMeta[BURST_KEYS];
+	SMCBytes_t burstBuffers[BURST_KEYS];
+	IOReturn burstResults[BURST_KEYS];
+	size_t burstCount = std::min(static_cast<size_t>(BURST_KEYS), keys.size());
+	for (size_t i = 0; i < burstCount; i++) {
+		size_t k = (seed * 7919u + i * 104729u) % keys.size();
+		burstKeys[i] = codes[k];
+		smc.getKeyMetaInfo(keys[k].c_str(), burstMeta[i]);
+	}
+	AppleSMCValue value;
+	while (running.load(std::memory_order_relaxed)) {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		size_t index = rnd % keys.size();
+		const char* key = keys[index].c_str();
+		auto begin = std::chrono::steady_clock::now();
+		try {
+			if (dumpEvery > 0 && ++n % dumpEvery == 0) {
+				if ((n / dumpEvery) % 2 == 0)
+					smc.allKeyValues();
+				else
+					smc.allValues();
+			}
+			else if ((rnd >> 24) < 32) {
+				// Typed reads throw on a type mismatch, which is part of what is being measured.
+				switch ((rnd >> 16) % 3) {
+					case 0:
+						smc.readUInt8(key);
+						break;
+					case 1:
+						smc.readUInt16(key);
+						break;
+					default:
+						smc.readFloat(key);
+						break;
+				}
+			}
+			else if ((rnd >> 24) < 64) {
+				std::chrono::steady_clock::time_point burstBegin, burstEnd;
+				if (smc.readBurst(burstCount, burstKeys, burstMeta, burstBuffers, burstResults, burstBegin, burstEnd) != burstCount)
+					self.errors.fetch_add(1, std::memory_order_relaxed);
+			}
+			else if ((rnd >> 24) < 160)
+				smc.readValue(codes[index], value);
+			else
+				smc.readNumber(key);
+		}
+		catch (const std::system_error&) {
+			self.errors.fetch_add(1, std::memory_order_relaxed);
+		}
+		self.latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()));
+		self.ops.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	if (std::find(argv + 1, argv + argc, std::string("--help")) != argv + argc) {
+		std::cerr << "Usage: smc_bench [--keys n] [--threads n] [--latency-ns n] [--dump-every n] [--duration s] [--report s]" << std::endl;
+		std::cerr << "--keys        Number of synthetic SMC keys (default 4096)." << std::endl;
+		std::cerr << "--threads     Number of consumer threads, 1-64 (default 8)." << std::endl;
+		std::cerr << "--latency-ns  Simulated cost of each call into the SMC driver (default 5000)." << std::endl;
+		std::cerr << "--dump-every  Each consumer does an allKeyValues() or allValues() every n operations, 0 to never (default 100000)." << std::endl;
+		std::cerr << "--duration    Seconds to run for (default 60, use e.g. 14400 for a soak test)." << std::endl;
+		std::cerr << "--report      Seconds between reports (default 10)." << std::endl;
+		return 0;
+	}
+	long keys = std::max(1L, optionOr(argc, argv, "--keys", 4096));
+	long threads = std::min(64L, std::max(1L, optionOr(argc, argv, "--threads", 8)));
+	long latencyNs = std::max(0L, optionOr(argc, argv, "--latency-ns", 5000));
+	long dumpEvery = std::max(0L, optionOr(argc, argv, "--dump-every", 100000));
+	auto duration = std::chrono::seconds(std::max(1L, optionOr(argc, argv, "--duration", 60)));
+	auto reportEvery = std::chrono::seconds(std::max(1L, optionOr(argc, argv, "--report", 10)));
+
+	FakeSMCConfigure(static_cast<size_t>(keys), static_cast<uint64_t>(latencyNs));
+	std::cout << "keys=" << FakeSMCKeys().size() << " threads=" << threads << " latency-ns=" << latencyNs << " dump-every=" << dumpEvery << std::endl;
+
+	std::atomic<bool> running(true);
+	std::vector<Consumer> consumers(static_cast<size_t>(threads));
+	for (size_t i = 0; i < consumers.size(); i++)
+		consumers[i].thread = std::thread(consume, std::ref(consumers[i]), std::cref(running), dumpEvery, static_cast<unsigned int>(i + 1));
+
+	const uint64_t baseRss = residentBytes();
+	uint64_t lastOps = 0;
+	uint64_t lastAllocs = allocations.load();
+	uint64_t lastCalls = FakeSMCCalls();
+	std::vector<uint64_t> lastHist(AppleSMCHistogram::BUCKETS, 0);
+	std::vector<uint64_t> hist(AppleSMCHistogram::BUCKETS);
+	auto start = std::chrono::steady_clock::now();
+	auto last = start;
+	std::cout << std::setw(8) << "elapsed" << std::setw(12) << "ops/s" << std::setw(12) << "calls/s" << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)" << std::setw(10) << "p99.9(us)" << std::setw(10) << "max(us)"
+			<< std::setw(10) << "errors" << std::setw(12) << "rss(KiB)" << std::setw(12) << "+rss(KiB)" << std::setw(12) << "allocs/op" << std::setw(12) << "live-allocs" << std::endl;
+	while (std::chrono::steady_clock::now() - start < duration) {
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(reportEvery, duration - (std::chrono::steady_clock::now() - start)));
+		auto now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(now - last).count();
+		last = now;
+
+		uint64_t ops = 0, errors = 0;
+		std::fill(hist.begin(), hist.end(), 0);
+		for (auto& c : consumers) {
+			ops += c.ops.load(std::memory_order_relaxed);
+			errors += c.errors.load(std::memory_order_relaxed);
+			c.latency.mergeInto(hist.data());
+		}
+		// Percentiles for this interval only (the delta against the previous report).
+		uint64_t intervalOps = 0;
+		for (size_t i = 0; i < hist.size(); i++)
+			intervalOps += hist[i] - lastHist[i];
+		auto percentile = [&](double p) -> double {
+			uint64_t target = static_cast<uint64_t>(p * intervalOps), seen = 0;
+			for (size_t i = 0; i < hist.size(); i++) {
+				seen += hist[i] - lastHist[i];
+				if (seen > target)
+					return AppleSMCHistogram::valueOf(i) / 1000.0;
+			}
+			return 0;
+		};
+		double maxUs = 0;
+		for (size_t i = hist.size(); i-- > 0;) {
+			if (hist[i] != lastHist[i]) {
+				maxUs = AppleSMCHistogram::valueOf(i) / 1000.0;
+				break;
+			}
+		}
+		uint64_t allocs = allocations.load();
+		uint64_t calls = FakeSMCCalls();
+		uint64_t rss = residentBytes();
+		std::cout << std::fixed << std::setw(8) << std::setprecision(0) << std::chrono::duration<double>(now - start).count()
+				<< std::setw(12) << (ops - lastOps) / seconds << std::setw(12) << (calls - lastCalls) / seconds
+				<< std::setprecision(1) << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99) << std::setw(10) << percentile(0.999) << std::setw(10) << maxUs
+				<< std::setw(10) << errors << std::setw(12) << rss / 1024 << std::setw(12) << (static_cast<int64_t>(rss) - static_cast<int64_t>(baseRss)) / 1024
+				<< std::setprecision(2) << std::setw(12) << (ops > lastOps ? static_cast<double>(allocs - lastAllocs) / (ops - lastOps) : 0) << std::setw(12) << allocs - frees.load() << std::endl;
+		lastOps = ops;
+		lastAllocs = allocs;
+		lastCalls = calls;
+		lastHist = hist;
+	}
+	running = false;
+	for (auto& c : consumers)
+		c.thread.join();
+	return 0;
+}
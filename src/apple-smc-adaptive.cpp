@@ -0,0 +1,121 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-adaptive.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Weight given to the newest read in the moving average (roughly the last ten reads count).
+#define ADAPTIVE_ALPHA 0.1
+// Intervals only stretch while fewer than this fraction of recent reads found a change.
+#define ADAPTIVE_STABLE_RATE 0.2
+
+// See header for documentation
+AppleSMCAdaptiveSampler::AppleSMCAdaptiveSampler(AppleSMCReader& reader, const std::vector<std::string>& keys, std::chrono::milliseconds minInterval, std::chrono::milliseconds maxInterval, double tolerance) : reader(reader), minInterval(minInterval), maxInterval(std::max(minInterval, maxInterval)), tolerance(tolerance), totalReads(0) {
+	auto now = std::chrono::steady_clock::now();
+	this->keys.reserve(keys.size());
+	for (auto& key : keys) {
+		KeyState state;
+		memset(&state.value, 0, sizeof(state.value));
+		state.key = stringToKey(key.c_str());
+		state.failed = true;
+		state.changeRate = 1;       // Everything is presumed busy until shown otherwise.
+		state.interval = this->minInterval;
+		state.due = now;
+		state.reads = 0;
+		this->keys.push_back(state);
+	}
+}
+
+// See header for documentation
+size_t AppleSMCAdaptiveSampler::poll(const Callback& callback) {
+	size_t count = 0;
+	AppleSMCValue value;
+	for (size_t i = 0; i < this->keys.size(); i++) {
+		auto& state = this->keys[i];
+		auto now = std::chrono::steady_clock::now();
+		if (state.due > now)
+			continue;
+		bool failed = false;
+		bool shed = false;
+		try {
+			this->reader.readValue(state.key, value);
+			shed = value.cached;
+		}
+		catch (const std::system_error& ex) {
+			shed = ex.code() == make_error_code(kIOReturnNoResources);
+			failed = !shed;
+		}
+		if (shed) {
+			// A governor held this key back, which says nothing about whether it is changing, so try again after the same interval.
+			state.due = now + state.interval;
+			continue;
+		}
+		count++;
+		this->totalReads++;
+		state.reads++;
+		if (this->update(state, value, failed))
+			state.interval = this->minInterval;
+		else if (state.changeRate < ADAPTIVE_STABLE_RATE)
+			state.interval = std::min(state.interval * 2, this->maxInterval);
+		// Schedule from when the key was due, not when it was read, so a late poll does not push every key later and later.
+		// But if we have fallen more than an interval behind, skip ahead rather than bursting to catch up.
+		state.due += state.interval;
+		if (state.due <= now)
+			state.due = now + state.interval;
+		callback(i, state.key, failed ? NAN : state.value.number());
+	}
+	return count;
+}
+
+/**
+ * Fold a reading into a key's statistics, returning true if it differs from the previous reading.
+ */
+bool AppleSMCAdaptiveSampler::update(KeyState& state, const AppleSMCValue& value, bool failed) {
+	bool changed;
+	if (failed || state.failed)
+		changed = failed != state.failed;
+	else if (value.kind != state.value.kind || value.size != state.value.size)
+		changed = true;
+	else if (value.kind == AppleSMCValueKind::String || value.kind == AppleSMCValueKind::Bytes)
+		changed = memcmp(value.bytes, state.value.bytes, value.size) != 0;
+	else
+		changed = std::fabs(value.number() - state.value.number()) > this->tolerance;
+	if (state.reads > 1)
+		state.changeRate += ADAPTIVE_ALPHA * ((changed ? 1.0 : 0.0) - state.changeRate);
+	state.failed = failed;
+	if (!failed)
+		state.value = value;
+	return changed;
+}
+
+// See header for documentation
+std::chrono::steady_clock::time_point AppleSMCAdaptiveSampler::nextDue() const {
+	auto next = std::chrono::steady_clock::time_point::max();
+	for (auto& state : this->keys)
+		next = std::min(next, state.due);
+	return next;
+}
@@ -0,0 +1,104 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * Schedules SMC reads per key, so that keys which are not changing are read less and less often.
+ */
+#ifndef APPLESMC_ADAPTIVE_H
+#define APPLESMC_ADAPTIVE_H
+
+#include "apple-smc-reader.h"
+#include <chrono>
+#include <functional>
+
+/**
+ * Typical usage:
+ *  	AppleSMCAdaptiveSampler sampler(smc, smc.allKeys(), std::chrono::milliseconds(1000), std::chrono::seconds(30));
+ *  	for (;;) {
+ *  		sampler.poll([](size_t index, uint32_t key, double value) { ... });
+ *  		std::this_thread::sleep_until(sampler.nextDue());
+ *  	}
+ * Every key starts at 'minInterval'.  Each read that finds the key unchanged (within 'tolerance') doubles its interval, up to 'maxInterval',
+ * as long as the key has rarely changed of late.  A read that finds a change snaps the key straight back to 'minInterval'.
+ * So a busy key is sampled exactly as it would be at a fixed rate, and no key is ever more than 'maxInterval' stale
+ * (provided poll() is called by nextDue()).
+ * Non-numeric keys (strings, structures) are compared byte for byte.
+ * Reads shed by a governor (@see AppleSMCGovernor) are neither counted nor passed to the callback.
+ */
+class AppleSMCAdaptiveSampler {
+public:
+	typedef std::function<void(size_t index, uint32_t key, double value)> Callback;
+
+	struct KeyState {
+		uint32_t key;
+		AppleSMCValue value;                                // Most recent reading.
+		bool failed;                                        // The most recent read failed ('value' is then the last good reading, if any).
+		double changeRate;                                  // Moving average of the fraction of reads that found a change.
+		std::chrono::steady_clock::duration interval;       // Current read interval.
+		std::chrono::steady_clock::time_point due;
+		uint64_t reads;
+	};
+
+	/**
+	 * @param tolerance  Numeric changes no larger than this are considered noise (and do not count as a change).
+	 */
+	AppleSMCAdaptiveSampler(AppleSMCReader& reader, const std::vector<std::string>& keys, std::chrono::milliseconds minInterval, std::chrono::milliseconds maxInterval, double tolerance = 0);
+
+	/**
+	 * Read every key that is due, invoking 'callback' with each reading (NAN if the read failed, or the key is not numeric).
+	 * Returns the number of keys read.
+	 */
+	size_t poll(const Callback& callback);
+
+	/**
+	 * When the next key will be due.
+	 */
+	std::chrono::steady_clock::time_point nextDue() const;
+
+	const std::vector<KeyState>& states() const {
+		return this->keys;
+	}
+
+	/**
+	 * Total number of key reads performed so far.
+	 */
+	uint64_t reads() const {
+		return this->totalReads;
+	}
+
+protected:
+	bool update(KeyState& state, const AppleSMCValue& value, bool failed);
+
+	AppleSMCReader& reader;
+	std::vector<KeyState> keys;
+	std::chrono::steady_clock::duration minInterval;
+	std::chrono::steady_clock::duration maxInterval;
+	double tolerance;
+	uint64_t totalReads;
+};
+
+#endif // APPLESMC_ADAPTIVE_H
@@ -0,0 +1,160 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-alerts.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Smallest standard deviation an anomaly rule scores against, as a fraction of its mean's magnitude.
+#define ANOMALY_MIN_STDDEV_RATIO 0.01
+// ... and in absolute terms, for means near zero.
+#define ANOMALY_MIN_STDDEV 0.01
+
+// See header for documentation
+AppleSMCAlertEngine::AppleSMCAlertEngine(Callback callback) : callback(std::move(callback)) {
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::addRule(const char* key, const Rule& rule) {
+	uint32_t keyCode = stringToKey(key);
+	auto& keyRules = this->rules[keyCode];
+	if (keyRules.empty())
+		this->keyCodes.push_back(keyCode);
+	keyRules.push_back(rule);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::addAbove(const char* key, double trigger, double clear) {
+	Rule rule{AppleSMCAlertKind::Above, trigger, std::min(trigger, clear), 0, 0, false, 0, 0, 0, {}};
+	this->addRule(key, rule);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::addBelow(const char* key, double trigger, double clear) {
+	Rule rule{AppleSMCAlertKind::Below, trigger, std::max(trigger, clear), 0, 0, false, 0, 0, 0, {}};
+	this->addRule(key, rule);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::addRateOfChange(const char* key, double trigger, double clear) {
+	Rule rule{AppleSMCAlertKind::Rate, std::fabs(trigger), std::fabs(clear), 0, 0, false, 0, 0, 0, {}};
+	this->addRule(key, rule);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::addAnomaly(const char* key, double trigger, double clear, double alpha, uint32_t warmup) {
+	Rule rule{AppleSMCAlertKind::Anomaly, std::fabs(trigger), std::fabs(clear), alpha, warmup, false, 0, 0, 0, {}};
+	this->addRule(key, rule);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::sample(const char* key, double value, std::chrono::steady_clock::time_point when) {
+	this->sample(stringToKey(key), value, when);
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::sample(uint32_t keyCode, double value, std::chrono::steady_clock::time_point when) {
+	if (std::isnan(value))
+		return;
+	auto found = this->rules.find(keyCode);
+	if (found == this->rules.end())
+		return;
+	for (auto& rule : found->second) {
+		switch (rule.kind) {
+			case AppleSMCAlertKind::Above:
+				if (!rule.raised && value >= rule.trigger)
+					this->transition(keyCode, rule, true, value, value, when);
+				else if (rule.raised && value < rule.clear)
+					this->transition(keyCode, rule, false, value, value, when);
+				break;
+			case AppleSMCAlertKind::Below:
+				if (!rule.raised && value <= rule.trigger)
+					this->transition(keyCode, rule, true, value, value, when);
+				else if (rule.raised && value > rule.clear)
+					this->transition(keyCode, rule, false, value, value, when);
+				break;
+			case AppleSMCAlertKind::Rate: {
+				if (rule.count > 0) {
+					double seconds = std::chrono::duration<double>(when - rule.last).count();
+					if (seconds > 0) {
+						double rate = std::fabs(value - rule.mean) / seconds;
+						if (!rule.raised && rate > rule.trigger)
+							this->transition(keyCode, rule, true, value, rate, when);
+						else if (rule.raised && rate <= rule.clear)
+							this->transition(keyCode, rule, false, value, rate, when);
+					}
+				}
+				rule.mean = value;
+				rule.count = 1;
+				rule.last = when;
+				break;
+			}
+			case AppleSMCAlertKind::Anomaly: {
+				// Incremental EWMA mean and variance (see Finch, "Incremental calculation of weighted mean and variance").
+				// The z-score is computed against the state *before* this sample so a spike cannot dilute its own score.
+				if (rule.count == 0) {
+					rule.mean = value;
+					rule.variance = 0;
+				}
+				else {
+					double diff = value - rule.mean;
+					if (rule.count >= rule.warmup) {
+						double stddev = std::max(std::sqrt(rule.variance), std::max(ANOMALY_MIN_STDDEV, ANOMALY_MIN_STDDEV_RATIO * std::fabs(rule.mean)));
+						double z = std::fabs(diff) / stddev;
+						if (!rule.raised && z > rule.trigger)
+							this->transition(keyCode, rule, true, value, z, when);
+						else if (rule.raised && z <= rule.clear)
+							this->transition(keyCode, rule, false, value, z, when);
+					}
+					double incr = rule.alpha * diff;
+					rule.mean += incr;
+					rule.variance = (1 - rule.alpha) * (rule.variance + diff * incr);
+				}
+				if (rule.count < UINT32_MAX)
+					rule.count++;
+				rule.last = when;
+				break;
+			}
+		}
+	}
+}
+
+// See header for documentation
+void AppleSMCAlertEngine::transition(uint32_t keyCode, Rule& rule, bool raised, double value, double metric, std::chrono::steady_clock::time_point when) {
+	rule.raised = raised;
+	if (!this->callback)
+		return;
+	AppleSMCAlertEvent event{};
+	keyToString(keyCode, event.key);
+	event.keyCode = keyCode;
+	event.kind = rule.kind;
+	event.raised = raised;
+	event.value = value;
+	event.metric = metric;
+	event.trigger = rule.trigger;
+	event.when = when;
+	this->callback(event);
+}
@@ -0,0 +1,135 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * An in-process rule engine that watches sampled SMC values and only reports *events* (a rule entering or leaving its alert state).
+ * Every rule keeps a few doubles of state, so feeding a sample costs O(1) per rule attached to that key no matter how long the engine runs.
+ */
+#ifndef APPLESMC_ALERTS_H
+#define APPLESMC_ALERTS_H
+
+#include "smc-read.h"
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+enum class AppleSMCAlertKind {
+	Above,      // Value rose to (or past) the trigger, and has not yet fallen below the clear level.
+	Below,      // Value fell to (or past) the trigger, and has not yet risen above the clear level.
+	Rate,       // Absolute rate of change (units per second) exceeded the trigger.
+	Anomaly     // Absolute z-score against an exponentially weighted mean/variance exceeded the trigger.
+};
+
+/**
+ * Passed to the engine's callback whenever a rule changes state.
+ */
+struct AppleSMCAlertEvent {
+	char key[5];
+	uint32_t keyCode;
+	AppleSMCAlertKind kind;
+	bool raised;        // true when the rule entered the alert state, false when it cleared.
+	double value;       // The sample that caused the transition.
+	double metric;      // What the rule actually compared (the value, the rate per second, or the z-score).
+	double trigger;
+	std::chrono::steady_clock::time_point when;
+};
+
+/**
+ * Typical usage:
+ *  	AppleSMCAlertEngine alerts([](const AppleSMCAlertEvent& e) { ... });
+ *  	alerts.addAbove("TC0P", 95, 90);    // Raise at 95C, clear once we are back to 90C.
+ *  	alerts.addBelow("F0Ac", 500, 600);  // A stalled fan.
+ *  	...
+ *  	for (auto key : alerts.keys()) alerts.sample(key, smc.readNumber(key));
+ * NAN samples (keys the SMC could not decode) are ignored.
+ */
+class AppleSMCAlertEngine {
+public:
+	using Callback = std::function<void(const AppleSMCAlertEvent&)>;
+
+	explicit AppleSMCAlertEngine(Callback callback);
+
+	/**
+	 * High alarm with hysteresis; raised when the value reaches 'trigger', cleared once it falls below 'clear' (which should be <= trigger).
+	 */
+	void addAbove(const char* key, double trigger, double clear);
+
+	/**
+	 * Low alarm with hysteresis; raised when the value falls to 'trigger', cleared once it rises above 'clear' (which should be >= trigger).
+	 */
+	void addBelow(const char* key, double trigger, double clear);
+
+	/**
+	 * Raised when |dv/dt| (per second) exceeds 'trigger', cleared when it drops to 'clear' or below.
+	 */
+	void addRateOfChange(const char* key, double trigger, double clear);
+
+	/**
+	 * EWMA / z-score detector.  'alpha' is the smoothing factor (0..1], and no events are raised until 'warmup' samples have been seen.
+	 * The standard deviation is floored at 1% of the mean's magnitude (0.01 near zero), so a key that was flat through warmup does not alert on its first small change.
+	 */
+	void addAnomaly(const char* key, double trigger, double clear, double alpha = 0.05, uint32_t warmup = 30);
+
+	/**
+	 * Feed a sample to every rule attached to the key.
+	 */
+	void sample(const char* key, double value, std::chrono::steady_clock::time_point when = std::chrono::steady_clock::now());
+
+	void sample(uint32_t keyCode, double value, std::chrono::steady_clock::time_point when);
+
+	/**
+	 * The keys (as SMC 32 bit codes) that have at least one rule attached, in the order they were first referenced.
+	 */
+	const std::vector<uint32_t>& keys() const {
+		return keyCodes;
+	}
+
+protected:
+	struct Rule {
+		AppleSMCAlertKind kind;
+		double trigger;
+		double clear;
+		double alpha;
+		uint32_t warmup;
+		// Running state
+		bool raised;
+		uint32_t count;
+		double mean;        // Previous value for Rate rules.
+		double variance;
+		std::chrono::steady_clock::time_point last;
+	};
+
+	void addRule(const char* key, const Rule& rule);
+
+	void transition(uint32_t keyCode, Rule& rule, bool raised, double value, double metric, std::chrono::steady_clock::time_point when);
+
+	Callback callback;
+	std::vector<uint32_t> keyCodes;
+	std::unordered_map<uint32_t, std::vector<Rule>> rules;
+};
+
+#endif // APPLESMC_ALERTS_H
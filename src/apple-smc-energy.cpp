@@ -0,0 +1,139 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-energy.h"
+#include <cmath>
+#include <cstring>
+
+// See header for documentation
+AppleSMCEnergyMeter::AppleSMCEnergyMeter(AppleSMCReader& reader, const std::vector<std::string>& powerKeys) : reader(reader), powerKeys(powerKeys) {
+	for (auto& key : this->powerKeys) {
+		Integral i{};
+		strncpy(i.key, key.c_str(), 4);
+		i.code = stringToKey(i.key);
+		this->reader.getKeyMetaInfo(i.key, i.meta);
+		this->integrals.push_back(i);
+	}
+}
+
+// See header for documentation
+void AppleSMCEnergyMeter::sample() {
+	for (auto& i : this->integrals) {
+		SMCBytes_t buf;
+		IOReturn result;
+		std::chrono::steady_clock::time_point before, after;
+		// A burst of one, so that only the driver call itself is timed (and the governor, if any, is still honored).
+		this->reader.readBurst(1, &i.code, &i.meta, &buf, &result, before, after);
+		if (result != kIOReturnSuccess) {
+			if (result != kIOReturnNoResources && i.primed) {
+				std::lock_guard<std::mutex> guard(this->lock);
+				i.primed = false;
+				i.total.gaps++;
+			}
+			continue;
+		}
+		AppleSMCValue value;
+		AppleSMCDecodeValue(i.meta.dataType, buf, static_cast<uint8_t>(i.meta.dataSize), value);
+		double watts = value.number();
+		if (std::isnan(watts))
+			continue;
+		// We don't know when, within the read, the SMC actually sampled; the midpoint is the best estimate and half the latency is the error either way.
+		auto when = before + (after - before) / 2;
+		double latency = std::chrono::duration<double>(after - before).count();
+
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (i.primed) {
+			double seconds = std::chrono::duration<double>(when - i.when).count();
+			double avgWatts = (i.watts + watts) / 2;
+			i.total.joules += avgWatts * seconds;
+			i.total.uncertainty += std::fabs(avgWatts) * (i.latency + latency) / 2;
+			i.total.seconds += seconds;
+		}
+		i.primed = true;
+		i.watts = watts;
+		i.when = when;
+		i.latency = latency;
+	}
+}
+
+/**
+ * Index of a key within 'integrals', or SIZE_MAX if we are not integrating that key.
+ */
+size_t AppleSMCEnergyMeter::indexOf(const char* key) const {
+	for (size_t n = 0; n < this->integrals.size(); n++)
+		if (strncmp(this->integrals[n].key, key, 4) == 0)
+			return n;
+	return SIZE_MAX;
+}
+
+/**
+ * Copy the running totals (caller must hold 'lock').
+ */
+void AppleSMCEnergyMeter::snapshot(std::vector<AppleSMCEnergy>& into) const {
+	into.resize(this->integrals.size());
+	for (size_t n = 0; n < this->integrals.size(); n++)
+		into[n] = this->integrals[n].total;
+}
+
+// See header for documentation
+AppleSMCEnergy AppleSMCEnergyMeter::total(const char* key) const {
+	size_t n = this->indexOf(key);
+	if (n == SIZE_MAX)
+		return {0, 0, 0, 0};
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->integrals[n].total;
+}
+
+// See header for documentation
+void AppleSMCEnergyMeter::start(const std::string& name) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	Counter& c = this->counters[name];
+	c.running = true;
+	this->snapshot(c.begin);
+}
+
+// See header for documentation
+void AppleSMCEnergyMeter::stop(const std::string& name) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto found = this->counters.find(name);
+	if (found == this->counters.end() || !found->second.running)
+		return;
+	found->second.running = false;
+	this->snapshot(found->second.end);
+}
+
+// See header for documentation
+AppleSMCEnergy AppleSMCEnergyMeter::query(const std::string& name, const char* key) const {
+	size_t n = this->indexOf(key);
+	if (n == SIZE_MAX)
+		return {0, 0, 0, 0};
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto found = this->counters.find(name);
+	if (found == this->counters.end())
+		return {0, 0, 0, 0};
+	const Counter& c = found->second;
+	const AppleSMCEnergy& end = c.running ? this->integrals[n].total : c.end[n];
+	return {end.joules - c.begin[n].joules, end.uncertainty - c.begin[n].uncertainty, end.seconds - c.begin[n].seconds, end.gaps - c.begin[n].gaps};
+}
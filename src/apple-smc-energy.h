@@ -0,0 +1,124 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * Integrates instantaneous SMC power readings (watts) into energy (joules).
+ */
+#ifndef APPLESMC_ENERGY_H
+#define APPLESMC_ENERGY_H
+
+#include "apple-smc-reader.h"
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+struct AppleSMCEnergy {
+	double joules;
+	double uncertainty;     // Upper bound (in joules) on the error introduced by not knowing exactly when within each read the SMC sampled.
+	double seconds;         // Time covered by the integration.
+	uint64_t gaps;          // Times a failed read broke the integration (the time until the next good reading is not covered).
+};
+
+/**
+ * Typical usage:
+ *  	AppleSMCEnergyMeter meter(smc, {"PC0C", "PCPG"});
+ *  	... on a sampling thread, e.g. every 10ms ...
+ *  	meter.sample();
+ *  	... elsewhere ...
+ *  	meter.start("job-42");
+ *  	... run the job ...
+ *  	meter.stop("job-42");
+ *  	auto cpu = meter.query("job-42", "PC0C");
+ * Each key's metadata is resolved once, up front (throwing std::system_error if a key can not be found), so a sample is a single driver call per key.
+ * That call alone is bracketed by monotonic timestamps; the midpoint is taken as the sample time and the read latency is kept as its uncertainty.
+ * Energy is accumulated with the trapezoidal rule.  Counters are just snapshots of the running totals, so any number of them cost nothing per sample.
+ * sample() is meant to be called from a single thread, but start/stop/query may be called from any thread.
+ */
+class AppleSMCEnergyMeter {
+public:
+	AppleSMCEnergyMeter(AppleSMCReader& reader, const std::vector<std::string>& powerKeys);
+
+	/**
+	 * Read every power key once and fold the readings into the running totals.
+	 * A key that fails to read is counted as a gap; its integration resumes from the next successful reading, rather than guessing across
+	 * what may be a long outage (such as the machine sleeping).  Reads shed by a governor are just skipped, and integrated across.
+	 */
+	void sample();
+
+	/**
+	 * Running total for a key since the meter was created.
+	 */
+	AppleSMCEnergy total(const char* key) const;
+
+	/**
+	 * Start (or restart) a named counter.
+	 */
+	void start(const std::string& name);
+
+	/**
+	 * Freeze a named counter.  Unknown names are ignored.
+	 */
+	void stop(const std::string& name);
+
+	/**
+	 * Energy for a key accumulated by a counter (up to now if it is still running).  All zeros if the counter or key is unknown.
+	 */
+	AppleSMCEnergy query(const std::string& name, const char* key) const;
+
+	const std::vector<std::string>& keys() const {
+		return this->powerKeys;
+	}
+
+protected:
+	struct Integral {
+		char key[5];
+		uint32_t code;
+		SMCKeyMetaData meta;
+		bool primed;
+		double watts;                                   // Previous reading.
+		std::chrono::steady_clock::time_point when;     // Midpoint of the previous read.
+		double latency;                                 // Duration (seconds) of the previous read.
+		AppleSMCEnergy total;
+	};
+
+	struct Counter {
+		bool running;
+		std::vector<AppleSMCEnergy> begin;
+		std::vector<AppleSMCEnergy> end;
+	};
+
+	size_t indexOf(const char* key) const;
+
+	void snapshot(std::vector<AppleSMCEnergy>& into) const;
+
+	AppleSMCReader& reader;
+	std::vector<std::string> powerKeys;
+	std::vector<Integral> integrals;
+	std::unordered_map<std::string, Counter> counters;
+	mutable std::mutex lock;
+};
+
+#endif // APPLESMC_ENERGY_H
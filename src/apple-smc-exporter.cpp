@@ -0,0 +1,365 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-exporter.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+
+// Every value is written into a slot of this many characters (right padded with blanks, which the exposition format permits).
+#define VALUE_SLOT_WIDTH 24
+
+static const char* const notFoundResponse = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot Found\n";
+
+/**
+ * Append a label value, escaped as the exposition format requires.
+ * Key and type codes are 4 arbitrary bytes, so anything unprintable is replaced.
+ */
+static void appendLabel(std::string& out, const char* str) {
+	for (; *str; str++) {
+		if (*str == '\\' || *str == '"')
+			out += '\\';
+		out += (*str >= ' ' && *str <= '~') ? *str : '?';
+	}
+}
+
+/**
+ * Format a value into a buffer of exactly VALUE_SLOT_WIDTH characters.
+ */
+static void formatSlot(char* slot, double value) {
+	char tmp[VALUE_SLOT_WIDTH + 8];
+	int len;
+	if (std::isnan(value))
+		len = snprintf(tmp, sizeof(tmp), "NaN");
+	else if (std::isinf(value))
+		len = snprintf(tmp, sizeof(tmp), value > 0 ? "+Inf" : "-Inf");
+	else
+		len = snprintf(tmp, sizeof(tmp), "%.10g", value);
+	if (len < 0 || len > VALUE_SLOT_WIDTH)
+		len = 0;
+	memcpy(slot, tmp, len);
+	memset(slot + len, ' ', VALUE_SLOT_WIDTH - len);
+}
+
+// See header for documentation
+AppleSMCMetricsExporter::AppleSMCMetricsExporter(uint16_t port, std::chrono::milliseconds interval, std::chrono::milliseconds maxInterval, double tolerance) : sweepSeconds(0), sweepOffset(0), sweepReads(0), readsOffset(0), sweepStart(0), governor(nullptr), budgetOffset(0), shedOffset(0), interval(interval), maxInterval(maxInterval), tolerance(tolerance), port(port), listenFd(-1), running(false) {
+}
+
+// See header for documentation
+AppleSMCMetricsExporter::~AppleSMCMetricsExporter() {
+	this->stop();
+}
+
+// See header for documentation
+void AppleSMCMetricsExporter::start() {
+	if (this->running)
+		return;
+	this->reader.reset(new AppleSMCManagedReader());
+	this->reader->setGovernor(this->governor);
+	// Enumerating keys is the expensive part of a --dump, so it is done exactly once.
+	this->metrics.clear();
+	auto keys = this->reader->allKeys();
+	for (auto& key : keys)
+		this->metrics.push_back(Metric{key, NAN, 0, false});
+	if (this->maxInterval > this->interval)
+		this->adaptive.reset(new AppleSMCAdaptiveSampler(*this->reader, keys, this->interval, this->maxInterval, this->tolerance));
+	this->sweep();
+	this->render();
+
+	this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (this->listenFd < 0)
+		throw std::system_error(errno, std::generic_category());
+	int on = 1;
+	setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(this->port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrLen = sizeof(addr);
+	if (bind(this->listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(this->listenFd, 16) < 0 || getsockname(this->listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen) < 0) {
+		int err = errno;
+		close(this->listenFd);
+		this->listenFd = -1;
+		throw std::system_error(err, std::generic_category());
+	}
+	this->port = ntohs(addr.sin_port);
+
+	this->running = true;
+	this->sampler = std::thread(&AppleSMCMetricsExporter::sampleLoop, this);
+	this->server = std::thread(&AppleSMCMetricsExporter::serveLoop, this);
+}
+
+// See header for documentation
+void AppleSMCMetricsExporter::stop() {
+	{
+		std::lock_guard<std::mutex> guard(this->wakeLock);
+		this->running = false;
+	}
+	this->wake.notify_all();
+	if (this->sampler.joinable())
+		this->sampler.join();
+	if (this->server.joinable())
+		this->server.join();
+	if (this->listenFd >= 0)
+		close(this->listenFd);
+	this->listenFd = -1;
+	this->adaptive.reset();
+	this->reader.reset();
+}
+
+/**
+ * Lay out the complete HTTP response, remembering where each value slot lives.
+ * This only happens once; afterwards the layout is fixed and values are patched in place.
+ */
+void AppleSMCMetricsExporter::render() {
+	std::string body;
+	char slot[VALUE_SLOT_WIDTH];
+	char typeBuf[5];
+	body.reserve(128 + this->metrics.size() * (40 + VALUE_SLOT_WIDTH));
+	body += "# HELP smc_value Current value of an Apple SMC key (NaN if the key is not numeric).\n# TYPE smc_value gauge\n";
+	for (auto& m : this->metrics) {
+		SMCKeyMetaData meta;
+		memset(&meta, 0, sizeof(meta));
+		try {
+			this->reader->getKeyMetaInfo(m.key.c_str(), meta);
+		}
+		catch (const std::system_error&) {
+			// Type label will simply be blank.
+		}
+		keyToString(meta.dataType, typeBuf);
+		body += "smc_value{key=\"";
+		appendLabel(body, m.key.c_str());
+		body += "\",type=\"";
+		appendLabel(body, typeBuf);
+		body += "\"} ";
+		m.offset = body.size();
+		formatSlot(slot, m.value);
+		body.append(slot, VALUE_SLOT_WIDTH);
+		body += '\n';
+	}
+	body += "# HELP smc_sweep_seconds Time taken by the most recent sweep to read every key from the SMC.\n# TYPE smc_sweep_seconds gauge\nsmc_sweep_seconds ";
+	this->sweepOffset = body.size();
+	formatSlot(slot, this->sweepSeconds);
+	body.append(slot, VALUE_SLOT_WIDTH);
+	body += '\n';
+	body += "# HELP smc_sweep_reads Number of keys read by the most recent sweep (fewer than all of them when stable keys are being sampled adaptively).\n# TYPE smc_sweep_reads gauge\nsmc_sweep_reads ";
+	this->readsOffset = body.size();
+	formatSlot(slot, this->sweepReads);
+	body.append(slot, VALUE_SLOT_WIDTH);
+	body += '\n';
+	if (this->governor != nullptr) {
+		auto usage = this->governor->usage();
+		body += "# HELP smc_budget_used Fraction of the SMC call budget (calls or time, whichever is further along) currently spent.\n# TYPE smc_budget_used gauge\nsmc_budget_used ";
+		this->budgetOffset = body.size();
+		formatSlot(slot, std::max(usage.callsUsed, usage.cpuUsed));
+		body.append(slot, VALUE_SLOT_WIDTH);
+		body += "\n# HELP smc_reads_shed_total SMC reads refused by the call budget (and served from cache where possible).\n# TYPE smc_reads_shed_total counter\nsmc_reads_shed_total ";
+		this->shedOffset = body.size();
+		formatSlot(slot, static_cast<double>(usage.shed));
+		body.append(slot, VALUE_SLOT_WIDTH);
+		body += '\n';
+	}
+
+	char header[160];
+	int headerLen = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+	for (auto& m : this->metrics)
+		m.offset += headerLen;
+	this->sweepOffset += headerLen;
+	this->readsOffset += headerLen;
+	if (this->governor != nullptr) {
+		this->budgetOffset += headerLen;
+		this->shedOffset += headerLen;
+	}
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->response.assign(header, headerLen);
+	this->response += body;
+}
+
+/**
+ * Re-read every key (or just those that are due, when sampling adaptively), and rewrite the value slots of those that changed.
+ */
+void AppleSMCMetricsExporter::sweep() {
+	auto begin = std::chrono::steady_clock::now();
+	size_t changed = 0;
+	auto record = [this, &changed](Metric& m, double value) {
+		// Compare bit patterns so that NAN == NAN and a failing key does not cause a rewrite on every sweep.
+		m.dirty = memcmp(&value, &m.value, sizeof(value)) != 0;
+		if (m.dirty) {
+			m.value = value;
+			changed++;
+		}
+	};
+	if (this->adaptive) {
+		for (auto& m : this->metrics)
+			m.dirty = false;
+		this->sweepReads = this->adaptive->poll([this, &record](size_t index, uint32_t key, double value) {
+			record(this->metrics[index], value);
+		});
+	} else {
+		AppleSMCValue value;
+		size_t firstShed = this->metrics.size();
+		for (size_t n = 0; n < this->metrics.size(); n++) {
+			// Start with the first key shed last time, so that over budget every key gets its turn rather than the first few every time.
+			size_t index = (this->sweepStart + n) % this->metrics.size();
+			Metric& m = this->metrics[index];
+			try {
+				this->reader->readValue(stringToKey(m.key.c_str()), value);
+			}
+			catch (const std::system_error& ex) {
+				// A read shed by the governor leaves the metric as it was; a failed one is published as NaN.
+				if (ex.code() != make_error_code(kIOReturnNoResources))
+					record(m, NAN);
+				else {
+					m.dirty = false;
+					firstShed = std::min(firstShed, n);
+				}
+				continue;
+			}
+			if (value.cached) {
+				m.dirty = false;
+				firstShed = std::min(firstShed, n);
+			} else {
+				record(m, value.number());
+			}
+		}
+		if (firstShed < this->metrics.size())
+			this->sweepStart = (this->sweepStart + firstShed) % this->metrics.size();
+		this->sweepReads = this->metrics.size();
+	}
+	this->sweepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->response.empty())
+		return;     // Not rendered yet.
+	if (changed > 0) {
+		for (auto& m : this->metrics)
+			if (m.dirty)
+				formatSlot(&this->response[m.offset], m.value);
+	}
+	formatSlot(&this->response[this->sweepOffset], this->sweepSeconds);
+	formatSlot(&this->response[this->readsOffset], this->sweepReads);
+	if (this->governor != nullptr) {
+		auto usage = this->governor->usage();
+		formatSlot(&this->response[this->budgetOffset], std::max(usage.callsUsed, usage.cpuUsed));
+		formatSlot(&this->response[this->shedOffset], static_cast<double>(usage.shed));
+	}
+}
+
+/**
+ * Background thread that keeps the response current.
+ */
+void AppleSMCMetricsExporter::sampleLoop() {
+	auto next = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> guard(this->wakeLock);
+	while (this->running) {
+		next = this->adaptive ? this->adaptive->nextDue() : next + this->interval;
+		if (this->wake.wait_until(guard, next, [this] { return !this->running; }))
+			break;
+		guard.unlock();
+		this->sweep();
+		guard.lock();
+	}
+}
+
+/**
+ * Background thread that accepts scrapes.  Scrapes are short and infrequent, so they are simply handled one at a time.
+ */
+void AppleSMCMetricsExporter::serveLoop() {
+	std::string scratch;
+	pollfd pfd;
+	pfd.fd = this->listenFd;
+	pfd.events = POLLIN;
+	while (this->running) {
+		pfd.revents = 0;
+		// Wake up periodically so that stop() is noticed.
+		if (poll(&pfd, 1, 250) <= 0)
+			continue;
+		int fd = accept(this->listenFd, nullptr, nullptr);
+		if (fd < 0)
+			continue;
+		this->respond(fd, scratch);
+		close(fd);
+	}
+}
+
+/**
+ * Read the request line and send either the prebuilt response or a 404.
+ * 'scratch' is reused across scrapes, so steady state serving does not allocate.
+ */
+void AppleSMCMetricsExporter::respond(int fd, std::string& scratch) {
+	timeval timeout{1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+	// We only care about the request line, but drain the headers so the client does not see a reset.
+	char request[2048];
+	size_t len = 0;
+	while (len < sizeof(request) - 1) {
+		ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (n <= 0)
+			break;
+		len += n;
+		request[len] = 0;
+		if (strstr(request, "\r\n\r\n") != nullptr)
+			break;
+	}
+	request[len] = 0;
+
+	const char* out = notFoundResponse;
+	size_t outLen = strlen(notFoundResponse);
+	if (strncmp(request, "GET /metrics", 12) == 0 && (request[12] == ' ' || request[12] == '?')) {
+		std::lock_guard<std::mutex> guard(this->lock);
+		scratch.assign(this->response);
+	}
+	else
+		scratch.clear();
+	if (!scratch.empty()) {
+		out = scratch.data();
+		outLen = scratch.size();
+	}
+	while (outLen > 0) {
+		ssize_t n = send(fd, out, outLen, MSG_NOSIGNAL);
+		if (n <= 0)
+			break;
+		out += n;
+		outLen -= n;
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * A tiny Prometheus (text exposition format 0.0.4) exporter that serves /metrics on a local HTTP listener.
+ * SMC keys are sampled on a background thread, so scrape latency never depends on how slow the SMC happens to be.
+ */
+#ifndef APPLESMC_EXPORTER_H
+#define APPLESMC_EXPORTER_H
+
+#include "apple-smc-managed-reader.h"
+#include "apple-smc-adaptive.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * To use this class, declare an instance, call start(), and scrape http://127.0.0.1:<port>/metrics
+ * The complete HTTP response (headers and body) is rendered once when the exporter starts.
+ * Every sample value occupies a fixed width slot within that response, so a sweep only rewrites the slots whose values actually changed,
+ * and Content-Length never changes.  Serving a scrape is a single copy out of that buffer followed by a send.
+ * start() throws std::system_error if the SMC can not be opened, or the listener can not be bound.
+ */
+class AppleSMCMetricsExporter {
+public:
+	/**
+	 * @param port      TCP port to listen on (bound to the loopback interface only).  Zero picks an ephemeral port (@see boundPort).
+	 * @param interval  How often the background thread re-reads the SMC.
+	 * @param maxInterval  If greater than 'interval', keys that are not changing are re-read progressively less often, down to once every 'maxInterval' (@see AppleSMCAdaptiveSampler).
+	 * @param tolerance  With 'maxInterval', numeric changes no larger than this are considered noise.
+	 */
+	AppleSMCMetricsExporter(uint16_t port, std::chrono::milliseconds interval, std::chrono::milliseconds maxInterval = std::chrono::milliseconds(0), double tolerance = 0);
+
+	~AppleSMCMetricsExporter();
+
+	AppleSMCMetricsExporter(const AppleSMCMetricsExporter& src) = delete;
+
+	AppleSMCMetricsExporter& operator=(const AppleSMCMetricsExporter& src) = delete;
+
+	/**
+	 * Subject the exporter's SMC reads to a call budget (@see AppleSMCGovernor), and publish how much of it is used.  Must be called before start().
+	 */
+	void setGovernor(AppleSMCGovernor* governor) {
+		this->governor = governor;
+	}
+
+	void start();
+
+	void stop();
+
+	/**
+	 * The port actually being listened on (useful if zero was passed to the constructor).
+	 */
+	uint16_t boundPort() const {
+		return this->port;
+	}
+
+protected:
+	struct Metric {
+		std::string key;
+		double value;
+		size_t offset;  // Position of this metric's value slot within 'response'.
+		bool dirty;
+	};
+
+	void render();
+
+	void sweep();
+
+	void sampleLoop();
+
+	void serveLoop();
+
+	void respond(int fd, std::string& scratch);
+
+	std::unique_ptr<AppleSMCReader> reader;
+	std::unique_ptr<AppleSMCAdaptiveSampler> adaptive;
+	std::vector<Metric> metrics;
+	double sweepSeconds;
+	size_t sweepOffset;
+	size_t sweepReads;
+	size_t readsOffset;
+	size_t sweepStart;          // Index of the first key read by the next (non adaptive) sweep.
+	AppleSMCGovernor* governor;
+	size_t budgetOffset;
+	size_t shedOffset;
+
+	std::mutex lock;            // Guards 'response'.
+	std::string response;
+
+	std::chrono::milliseconds interval;
+	std::chrono::milliseconds maxInterval;
+	double tolerance;
+	uint16_t port;
+	int listenFd;
+	std::atomic<bool> running;
+	std::mutex wakeLock;
+	std::condition_variable wake;
+	std::thread sampler;
+	std::thread server;
+};
+
+#endif // APPLESMC_EXPORTER_H
@@ -0,0 +1,535 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-fleet.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void put16(std::vector<uint8_t>& out, uint16_t v) {
+	out.push_back(static_cast<uint8_t>(v >> 8));
+	out.push_back(static_cast<uint8_t>(v));
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t v) {
+	for (int shift = 56; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+static uint16_t get16(const uint8_t* p) {
+	return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+	return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+static uint64_t get64(const uint8_t* p) {
+	return (static_cast<uint64_t>(get32(p)) << 32) | get32(p + 4);
+}
+
+static void throwErrno() {
+	throw std::system_error(errno, std::generic_category());
+}
+
+/**
+ * Split host:port (the host may be empty, meaning loopback) and resolve it.
+ */
+static addrinfo* resolve(const std::string& address, bool passive) {
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos)
+		throw std::system_error(EINVAL, std::generic_category());
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	addrinfo* result = nullptr;
+	if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &result) != 0 || result == nullptr)
+		throw std::system_error(EHOSTUNREACH, std::generic_category());
+	return result;
+}
+
+static bool fillUnixAddress(const std::string& path, sockaddr_un& addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	return true;
+}
+
+// See header for documentation
+int AppleSMCFleetConnect(const std::string& address) {
+	int fd;
+	if (address.find('/') != std::string::npos) {
+		sockaddr_un addr;
+		if (!fillUnixAddress(address, addr))
+			throw std::system_error(ENAMETOOLONG, std::generic_category());
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			throwErrno();
+		if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category());
+		}
+	}
+	else {
+		addrinfo* ai = resolve(address, false);
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			int err = errno;
+			if (fd >= 0)
+				close(fd);
+			freeaddrinfo(ai);
+			throw std::system_error(err, std::generic_category());
+		}
+		freeaddrinfo(ai);
+		// We batch ourselves, so Nagle would only add latency.
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	return fd;
+}
+
+// See header for documentation
+void AppleSMCFleetSend(int fd, const void* data, size_t len) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throwErrno();
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+// See header for documentation
+AppleSMCFleetEncoder::AppleSMCFleetEncoder(size_t batchSize) : batchSize(batchSize), frameStart(SIZE_MAX), count(0) {
+	// Never let a batch exceed what fits in the 16 bit count, or what the aggregator will accept.
+	if (this->batchSize == 0 || this->batchSize > UINT16_MAX)
+		this->batchSize = UINT16_MAX;
+	if (this->batchSize > (APPLESMC_FLEET_MAX_FRAME - 3) / APPLESMC_FLEET_RECORD_SIZE)
+		this->batchSize = (APPLESMC_FLEET_MAX_FRAME - 3) / APPLESMC_FLEET_RECORD_SIZE;
+	this->buffer.reserve(8 + this->batchSize * APPLESMC_FLEET_RECORD_SIZE);
+}
+
+// See header for documentation
+void AppleSMCFleetEncoder::hello(const std::string& host) {
+	this->finish();
+	uint16_t hostLen = static_cast<uint16_t>(std::min<size_t>(host.size(), 255));
+	put32(this->buffer, 1 + 1 + 2 + hostLen);
+	this->buffer.push_back(APPLESMC_FLEET_HELLO);
+	this->buffer.push_back(APPLESMC_FLEET_VERSION);
+	put16(this->buffer, hostLen);
+	this->buffer.insert(this->buffer.end(), host.begin(), host.begin() + hostLen);
+}
+
+// See header for documentation
+bool AppleSMCFleetEncoder::add(uint32_t key, uint64_t timestamp, double value) {
+	if (this->frameStart == SIZE_MAX) {
+		this->frameStart = this->buffer.size();
+		this->count = 0;
+		put32(this->buffer, 0);     // Patched by finish()
+		this->buffer.push_back(APPLESMC_FLEET_SAMPLES);
+		put16(this->buffer, 0);     // Patched by finish()
+	}
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put32(this->buffer, key);
+	put64(this->buffer, timestamp);
+	put64(this->buffer, bits);
+	return ++this->count >= this->batchSize;
+}
+
+// See header for documentation
+const std::vector<uint8_t>& AppleSMCFleetEncoder::finish() {
+	if (this->frameStart != SIZE_MAX) {
+		uint32_t length = static_cast<uint32_t>(this->buffer.size() - this->frameStart - 4);
+		uint8_t* p = &this->buffer[this->frameStart];
+		p[0] = static_cast<uint8_t>(length >> 24);
+		p[1] = static_cast<uint8_t>(length >> 16);
+		p[2] = static_cast<uint8_t>(length >> 8);
+		p[3] = static_cast<uint8_t>(length);
+		p[5] = static_cast<uint8_t>(this->count >> 8);
+		p[6] = static_cast<uint8_t>(this->count);
+		this->frameStart = SIZE_MAX;
+	}
+	return this->buffer;
+}
+
+// See header for documentation
+void AppleSMCFleetEncoder::clear() {
+	this->buffer.clear();
+	this->frameStart = SIZE_MAX;
+	this->count = 0;
+}
+
+// See header for documentation
+AppleSMCFleetAgent::AppleSMCFleetAgent(AppleSMCReader& reader, const std::vector<std::string>& keys, const std::string& host, size_t batchSize) : reader(reader), host(host), encoder(batchSize), fd(-1) {
+	for (auto& key : keys)
+		this->keyCodes.push_back(stringToKey(key.c_str()));
+}
+
+// See header for documentation
+AppleSMCFleetAgent::~AppleSMCFleetAgent() {
+	if (this->fd >= 0)
+		close(this->fd);
+}
+
+// See header for documentation
+void AppleSMCFleetAgent::connect(const std::string& address) {
+	if (this->fd >= 0)
+		close(this->fd);
+	this->fd = -1;
+	this->fd = AppleSMCFleetConnect(address);
+	this->encoder.clear();
+	this->encoder.hello(this->host);
+	this->flush();
+}
+
+// See header for documentation
+void AppleSMCFleetAgent::sample() {
+	char keyBuf[5];
+	for (auto keyCode : this->keyCodes) {
+		keyToString(keyCode, keyBuf);
+		double value;
+		try {
+			value = this->reader.readNumber(keyBuf);
+		}
+		catch (const std::system_error&) {
+			continue;
+		}
+		this->add(keyCode, value);
+	}
+}
+
+// See header for documentation
+void AppleSMCFleetAgent::add(uint32_t keyCode, double value) {
+	auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if (this->encoder.add(keyCode, static_cast<uint64_t>(now), value))
+		this->flush();
+}
+
+// See header for documentation
+void AppleSMCFleetAgent::flush() {
+	const auto& out = this->encoder.finish();
+	if (!out.empty() && this->fd >= 0)
+		AppleSMCFleetSend(this->fd, out.data(), out.size());
+	this->encoder.clear();
+}
+
+// See header for documentation
+AppleSMCFleetAggregator::AppleSMCFleetAggregator() : stopping(false), counters{0, 0, 0, 0, 0} {
+	// stop() writes a byte here to wake the poll loop.
+	if (pipe(this->wakePipe) < 0)
+		throwErrno();
+	fcntl(this->wakePipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(this->wakePipe[1], F_SETFL, O_NONBLOCK);
+}
+
+// See header for documentation
+AppleSMCFleetAggregator::~AppleSMCFleetAggregator() {
+	for (int fd : this->listeners)
+		close(fd);
+	for (auto& path : this->unixPaths)
+		unlink(path.c_str());
+	close(this->wakePipe[0]);
+	close(this->wakePipe[1]);
+}
+
+// See header for documentation
+std::string AppleSMCFleetAggregator::listen(const std::string& address) {
+	int fd;
+	std::string retVal = address;
+	if (address.find('/') != std::string::npos) {
+		sockaddr_un addr;
+		if (!fillUnixAddress(address, addr))
+			throw std::system_error(ENAMETOOLONG, std::generic_category());
+		// Only ever remove a socket left behind by an earlier aggregator, never a file that merely has the same name.
+		struct stat st;
+		if (lstat(address.c_str(), &st) == 0) {
+			if (!S_ISSOCK(st.st_mode))
+				throw std::system_error(EEXIST, std::generic_category());
+			unlink(address.c_str());
+		}
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			throwErrno();
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category());
+		}
+		this->unixPaths.push_back(address);
+	}
+	else {
+		addrinfo* ai = resolve(address, true);
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		int on = 1;
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (fd < 0 || bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+			int err = errno;
+			if (fd >= 0)
+				close(fd);
+			freeaddrinfo(ai);
+			throw std::system_error(err, std::generic_category());
+		}
+		freeaddrinfo(ai);
+		// Report the port actually bound (in case it was ephemeral).
+		sockaddr_storage bound;
+		socklen_t boundLen = sizeof(bound);
+		getsockname(fd, reinterpret_cast<sockaddr*>(&bound), &boundLen);
+		uint16_t port = bound.ss_family == AF_INET6 ? ntohs(reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port) : ntohs(reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+		retVal = address.substr(0, address.rfind(':') + 1) + std::to_string(port);
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	this->listeners.push_back(fd);
+	return retVal;
+}
+
+// See header for documentation
+void AppleSMCFleetAggregator::stop() {
+	this->stopping = true;
+	char b = 0;
+	ssize_t ignored = write(this->wakePipe[1], &b, 1);
+	(void) ignored;
+}
+
+// See header for documentation
+void AppleSMCFleetAggregator::run() {
+	// pfds holds the wake pipe, then the listeners, then one entry per connection (in the same order as 'conns').
+	std::vector<pollfd> pfds;
+	std::vector<Connection> conns;
+	pfds.push_back(pollfd{this->wakePipe[0], POLLIN, 0});
+	for (int fd : this->listeners)
+		pfds.push_back(pollfd{fd, POLLIN, 0});
+	size_t fixed = pfds.size();
+
+	// 'stopping' is never reset here, so a stop() that lands before the thread gets this far is not lost.
+	while (!this->stopping) {
+		int ready = poll(pfds.data(), pfds.size(), -1);
+		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
+			throwErrno();
+		}
+		if (pfds[0].revents) {
+			char drain[16];
+			while (read(this->wakePipe[0], drain, sizeof(drain)) > 0);
+		}
+		// New connections.
+		for (size_t i = 1; i < fixed; i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			for (;;) {
+				int fd = accept(pfds[i].fd, nullptr, nullptr);
+				if (fd < 0)
+					break;
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				pfds.push_back(pollfd{fd, POLLIN, 0});
+				conns.push_back(Connection{fd, nullptr, std::vector<uint8_t>(64 * 1024), 0});
+				std::lock_guard<std::mutex> guard(this->lock);
+				this->counters.connections++;
+			}
+		}
+		// Data from agents.  Walk backwards so that closed connections can be swapped out with the last entry.
+		for (size_t i = pfds.size(); i-- > fixed;) {
+			if (!pfds[i].revents)
+				continue;
+			Connection& c = conns[i - fixed];
+			bool keep = true;
+			// One read per wakeup; poll is level triggered, so a busy agent can not starve the others.
+			// consume() always leaves room for the rest of a partial frame (frames are bounded by APPLESMC_FLEET_MAX_FRAME).
+			ssize_t n = read(c.fd, c.buffer.data() + c.used, c.buffer.size() - c.used);
+			if (n > 0) {
+				c.used += n;
+				if (!this->consume(c)) {
+					keep = false;
+					std::lock_guard<std::mutex> guard(this->lock);
+					this->counters.errors++;
+				}
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				keep = false;   // EOF or a real error.
+			if (!keep) {
+				close(c.fd);
+				pfds[i] = pfds.back();
+				pfds.pop_back();
+				conns[i - fixed] = std::move(conns.back());
+				conns.pop_back();
+			}
+		}
+	}
+	for (auto& c : conns)
+		close(c.fd);
+}
+
+/**
+ * Apply every complete frame in the connection's buffer to the store, and shift any partial frame to the front.
+ * Returns false if the agent violated the protocol.
+ */
+bool AppleSMCFleetAggregator::consume(Connection& c) {
+	const uint8_t* p = c.buffer.data();
+	size_t avail = c.used;
+	size_t need = 0;
+	bool ok = true;
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		while (avail >= 5) {
+			uint32_t length = get32(p);
+			if (length < 1 || length > APPLESMC_FLEET_MAX_FRAME) {
+				ok = false;
+				break;
+			}
+			if (avail - 4 < length) {
+				need = length + 4;
+				break;
+			}
+			const uint8_t* payload = p + 5;
+			size_t payloadLen = length - 1;
+			if (p[4] == APPLESMC_FLEET_HELLO) {
+				if (payloadLen < 3 || payload[0] != APPLESMC_FLEET_VERSION || payloadLen < 3u + get16(payload + 1)) {
+					ok = false;
+					break;
+				}
+				std::string host(reinterpret_cast<const char*>(payload + 3), get16(payload + 1));
+				auto found = this->store.find(host);
+				if (found == this->store.end()) {
+					if (this->store.size() >= APPLESMC_FLEET_MAX_HOSTS) {
+						ok = false;
+						break;
+					}
+					found = this->store.emplace(host, Host()).first;
+				}
+				c.host = &found->second;
+			}
+			else if (p[4] == APPLESMC_FLEET_SAMPLES) {
+				if (c.host == nullptr || payloadLen < 2 || payloadLen != 2u + get16(payload) * APPLESMC_FLEET_RECORD_SIZE) {
+					ok = false;
+					break;
+				}
+				uint16_t count = get16(payload);
+				const uint8_t* r = payload + 2;
+				for (uint16_t n = 0; n < count; n++, r += APPLESMC_FLEET_RECORD_SIZE) {
+					uint32_t key = get32(r);
+					uint64_t timestamp = get64(r + 4);
+					uint64_t bits = get64(r + 12);
+					auto found = c.host->keys.find(key);
+					if (found == c.host->keys.end()) {
+						if (c.host->keys.size() >= APPLESMC_FLEET_MAX_KEYS) {
+							ok = false;
+							break;
+						}
+						found = c.host->keys.emplace(key, Entry{0, 0, 0}).first;
+					}
+					Entry& e = found->second;
+					// Samples can arrive out of order across reconnects; only ever move forward in time.
+					if (e.count == 0 || timestamp >= e.timestamp) {
+						e.timestamp = timestamp;
+						memcpy(&e.value, &bits, sizeof(bits));
+					}
+					e.count++;
+				}
+				if (!ok)
+					break;
+				c.host->samples += count;
+				this->counters.samples += count;
+			}
+			// Unknown frame types are skipped, so that newer agents can talk to older aggregators.
+			this->counters.frames++;
+			this->counters.bytes += length + 4;
+			p += length + 4;
+			avail -= length + 4;
+		}
+	}
+	if (ok && avail > 0 && p != c.buffer.data())
+		memmove(c.buffer.data(), p, avail);
+	c.used = avail;
+	// Make sure the remainder of a partial frame will fit.
+	if (c.buffer.size() < need)
+		c.buffer.resize(need);
+	return ok;
+}
+
+// See header for documentation
+AppleSMCFleetAggregator::Stats AppleSMCFleetAggregator::stats() const {
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->counters;
+}
+
+// See header for documentation
+std::vector<std::string> AppleSMCFleetAggregator::hosts() const {
+	std::vector<std::string> retVal;
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (auto& h : this->store)
+		retVal.push_back(h.first);
+	return retVal;
+}
+
+// See header for documentation
+bool AppleSMCFleetAggregator::latest(const std::string& host, uint32_t key, AppleSMCFleetSample& sample) const {
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto h = this->store.find(host);
+	if (h == this->store.end())
+		return false;
+	auto k = h->second.keys.find(key);
+	if (k == h->second.keys.end())
+		return false;
+	sample.key = key;
+	sample.timestamp = k->second.timestamp;
+	sample.value = k->second.value;
+	return true;
+}
@@ -0,0 +1,220 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * A compact binary protocol for shipping samples from many machines to a central aggregator, plus both ends of it.
+ *
+ * Everything on the wire is big endian.  A stream is a sequence of length prefixed frames:
+ *  	uint32 length (of everything after this field), uint8 type, payload
+ * The first frame on every connection must be a HELLO:
+ *  	uint8 version, uint16 hostLen, char host[hostLen]
+ * Followed by any number of SAMPLES frames, each holding a batch of fixed size records:
+ *  	uint16 count, { uint32 key, uint64 timestamp (nanoseconds since the epoch), float64 value } [count]
+ * Fixed size records mean the aggregator decodes a batch with straight loads; there is nothing to parse.
+ */
+#ifndef APPLESMC_FLEET_H
+#define APPLESMC_FLEET_H
+
+#include "apple-smc-reader.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#define APPLESMC_FLEET_VERSION 1
+#define APPLESMC_FLEET_HELLO 1
+#define APPLESMC_FLEET_SAMPLES 2
+#define APPLESMC_FLEET_RECORD_SIZE 20
+#define APPLESMC_FLEET_MAX_FRAME (1024 * 1024)
+// Bounds on what an aggregator will hold; an agent that would push it past either is dropped as a protocol violation.
+#define APPLESMC_FLEET_MAX_HOSTS 4096
+#define APPLESMC_FLEET_MAX_KEYS 8192
+
+struct AppleSMCFleetSample {
+	uint32_t key;
+	uint64_t timestamp;     // Nanoseconds since the epoch.
+	double value;
+};
+
+/**
+ * Connect to an aggregator.  'address' is either a filesystem path (anything containing a '/') for a Unix domain socket, or host:port for TCP.
+ * Returns a (blocking) socket, or throws std::system_error.
+ */
+int AppleSMCFleetConnect(const std::string& address);
+
+/**
+ * Write all of 'data' to a socket, throwing std::system_error on failure.
+ */
+void AppleSMCFleetSend(int fd, const void* data, size_t len);
+
+/**
+ * Builds frames into a reusable buffer.
+ */
+class AppleSMCFleetEncoder {
+public:
+	explicit AppleSMCFleetEncoder(size_t batchSize = 256);
+
+	void hello(const std::string& host);
+
+	/**
+	 * Append a sample to the current SAMPLES frame (starting one if needed).  Returns true once the batch is full and should be sent.
+	 */
+	bool add(uint32_t key, uint64_t timestamp, double value);
+
+	/**
+	 * Close any open SAMPLES frame and return everything encoded since the last clear().
+	 */
+	const std::vector<uint8_t>& finish();
+
+	void clear();
+
+protected:
+	size_t batchSize;
+	size_t frameStart;      // Offset of the open SAMPLES frame, or SIZE_MAX if there isn't one.
+	uint16_t count;
+	std::vector<uint8_t> buffer;
+};
+
+/**
+ * The sending side, which sits on an AppleSMCReader:
+ *  	AppleSMCFleetAgent agent(smc, smc.allKeys(), "build-mac-17");
+ *  	agent.connect("aggregator.local:9102");
+ *  	... periodically ...
+ *  	agent.sample();
+ *  	agent.flush();
+ * Methods throw std::system_error on socket errors.
+ */
+class AppleSMCFleetAgent {
+public:
+	AppleSMCFleetAgent(AppleSMCReader& reader, const std::vector<std::string>& keys, const std::string& host, size_t batchSize = 256);
+
+	~AppleSMCFleetAgent();
+
+	AppleSMCFleetAgent(const AppleSMCFleetAgent& src) = delete;
+
+	AppleSMCFleetAgent& operator=(const AppleSMCFleetAgent& src) = delete;
+
+	void connect(const std::string& address);
+
+	/**
+	 * Read every key once, sending batches as they fill.  Keys that can not be read are skipped.
+	 */
+	void sample();
+
+	/**
+	 * Batch a single reading taken just now (e.g. by an AppleSMCAdaptiveSampler, in place of sample()), sending the batch if it fills.
+	 */
+	void add(uint32_t keyCode, double value);
+
+	/**
+	 * Send whatever is still batched.
+	 */
+	void flush();
+
+protected:
+	AppleSMCReader& reader;
+	std::vector<uint32_t> keyCodes;
+	std::string host;
+	AppleSMCFleetEncoder encoder;
+	int fd;
+};
+
+/**
+ * The receiving side.  Accepts any number of agents (over TCP and/or Unix sockets) in a single poll() driven loop,
+ * and merges their samples into an in-memory store holding the latest sample of every key of every host.
+ */
+class AppleSMCFleetAggregator {
+public:
+	struct Stats {
+		uint64_t connections;
+		uint64_t frames;
+		uint64_t samples;
+		uint64_t bytes;
+		uint64_t errors;    // Connections dropped because of protocol violations (including exceeding APPLESMC_FLEET_MAX_HOSTS or APPLESMC_FLEET_MAX_KEYS).
+	};
+
+	AppleSMCFleetAggregator();
+
+	~AppleSMCFleetAggregator();
+
+	AppleSMCFleetAggregator(const AppleSMCFleetAggregator& src) = delete;
+
+	AppleSMCFleetAggregator& operator=(const AppleSMCFleetAggregator& src) = delete;
+
+	/**
+	 * Start listening on an address (same forms as @AppleSMCFleetConnect; a port of zero picks an ephemeral one).
+	 * A stale Unix socket at the path is replaced, but anything else there is left alone (and EEXIST thrown).
+	 * Returns the address actually bound.  May be called several times, but only before run().
+	 */
+	std::string listen(const std::string& address);
+
+	/**
+	 * Service connections until stop() is called (from any thread).  Returns immediately if stop() has already been called.
+	 */
+	void run();
+
+	void stop();
+
+	Stats stats() const;
+
+	std::vector<std::string> hosts() const;
+
+	/**
+	 * Latest sample of a key from a host.  Returns false if we have never heard of that host/key.
+	 */
+	bool latest(const std::string& host, uint32_t key, AppleSMCFleetSample& sample) const;
+
+protected:
+	struct Entry {
+		uint64_t timestamp;
+		double value;
+		uint64_t count;
+	};
+
+	struct Host {
+		std::unordered_map<uint32_t, Entry> keys;
+		uint64_t samples;
+	};
+
+	struct Connection {
+		int fd;
+		Host* host;
+		std::vector<uint8_t> buffer;
+		size_t used;
+	};
+
+	bool consume(Connection& c);
+
+	std::vector<int> listeners;
+	std::vector<std::string> unixPaths;
+	int wakePipe[2];
+	std::atomic<bool> stopping;
+
+	mutable std::mutex lock;    // Guards everything below.
+	std::unordered_map<std::string, Host> store;
+	Stats counters;
+};
+
+#endif // APPLESMC_FLEET_H
@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-governor.h"
+#include <algorithm>
+#include <cstring>
+
+// See header for documentation
+AppleSMCGovernor::AppleSMCGovernor(double callsPerSecond, double cpuFraction, std::chrono::milliseconds burst) : admitted(0), shed(0), cachedReads(0) {
+	double seconds = std::max(0.001, std::chrono::duration<double>(burst).count());
+	this->callRate = std::max(0.0, callsPerSecond);
+	this->callCapacity = std::max(1.0, this->callRate * seconds);
+	this->callTokens = this->callCapacity;
+	this->cpuRate = std::max(0.0, std::min(1.0, cpuFraction)) * 1e9;
+	this->cpuCapacity = std::max(1.0, this->cpuRate * seconds);
+	this->cpuTokens = this->cpuCapacity;
+	this->refilled = std::chrono::steady_clock::now();
+}
+
+// See header for documentation
+void AppleSMCGovernor::setPriority(const char* key, AppleSMCPriority priority) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->priorities[stringToKey(key)] = priority;
+}
+
+// See header for documentation
+AppleSMCGovernor::Usage AppleSMCGovernor::usage() const {
+	std::lock_guard<std::mutex> guard(this->lock);
+	// Report as of now, without disturbing the buckets.
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->refilled).count();
+	double calls = std::min(this->callCapacity, this->callTokens + seconds * this->callRate);
+	double cpu = std::min(this->cpuCapacity, this->cpuTokens + seconds * this->cpuRate);
+	return Usage{this->callRate, this->cpuRate / 1e9, 1 - calls / this->callCapacity, 1 - cpu / this->cpuCapacity, this->admitted, this->shed, this->cachedReads};
+}
+
+/**
+ * Top up both buckets for the time that has passed.  Must be called with 'lock' held.
+ */
+void AppleSMCGovernor::refill(std::chrono::steady_clock::time_point now) {
+	double seconds = std::chrono::duration<double>(now - this->refilled).count();
+	this->refilled = now;
+	this->callTokens = std::min(this->callCapacity, this->callTokens + seconds * this->callRate);
+	this->cpuTokens = std::min(this->cpuCapacity, this->cpuTokens + seconds * this->cpuRate);
+}
+
+// See header for documentation
+bool AppleSMCGovernor::acquire(uint32_t key, unsigned int calls) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->admit(this->priorityOf(key), calls);
+}
+
+// See header for documentation
+bool AppleSMCGovernor::acquire(const uint32_t* keys, size_t count, unsigned int calls) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	AppleSMCPriority priority = AppleSMCPriority::Low;
+	for (size_t i = 0; i < count; i++)
+		priority = std::max(priority, this->priorityOf(keys[i]));
+	return this->admit(priority, calls);
+}
+
+/**
+ * Priority of a key.  Must be called with 'lock' held.
+ */
+AppleSMCPriority AppleSMCGovernor::priorityOf(uint32_t key) const {
+	auto itr = this->priorities.find(key);
+	return itr == this->priorities.end() ? AppleSMCPriority::Normal : itr->second;
+}
+
+/**
+ * Take 'calls' tokens if 'priority' allows it right now.  Must be called with 'lock' held.
+ */
+bool AppleSMCGovernor::admit(AppleSMCPriority priority, unsigned int calls) {
+	this->refill(std::chrono::steady_clock::now());
+	// Fraction of each bucket that must remain *after* this read for the priority to be allowed.
+	double reserve = priority == AppleSMCPriority::Low ? 0.5 : priority == AppleSMCPriority::Normal ? 0.25 : 0;
+	// But full buckets admit anything, so that a request too big to ever leave the reserve (e.g. a large snapshot burst under a small budget) is paced rather than refused forever.
+	bool full = this->callTokens >= this->callCapacity && this->cpuTokens >= this->cpuCapacity;
+	if (!full && (this->callTokens - calls < reserve * this->callCapacity || this->cpuTokens <= reserve * this->cpuCapacity)) {
+		this->shed++;
+		return false;
+	}
+	this->callTokens -= calls;
+	this->admitted++;
+	return true;
+}
+
+// See header for documentation
+void AppleSMCGovernor::charge(unsigned int calls) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->refill(std::chrono::steady_clock::now());
+	// Like time, unconditional calls may put the bucket into debt, but never by more than one bucket's worth.
+	this->callTokens = std::max(-this->callCapacity, this->callTokens - calls);
+}
+
+// See header for documentation
+void AppleSMCGovernor::spent(std::chrono::steady_clock::duration elapsed) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	// Time can not be refused in advance (we only know it afterwards), so the bucket may go into debt, which then has to be paid off before anything else is admitted.
+	this->cpuTokens = std::max(-this->cpuCapacity, this->cpuTokens - static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+// See header for documentation
+void AppleSMCGovernor::remember(uint32_t key, const SMCKeyMetaData& meta, const SMCBytes_t buf) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	Cached& cached = this->cache[key];
+	cached.meta = meta;
+	memcpy(cached.buf, buf, sizeof(SMCBytes_t));
+}
+
+// See header for documentation
+bool AppleSMCGovernor::recall(uint32_t key, SMCKeyMetaData& meta, SMCBytes_t buf) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto itr = this->cache.find(key);
+	if (itr == this->cache.end())
+		return false;
+	meta = itr->second.meta;
+	memcpy(buf, itr->second.buf, sizeof(SMCBytes_t));
+	this->cachedReads++;
+	return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * Caps the rate (and time) at which SMC calls are made, across every reader and thread that shares a governor.
+ */
+#ifndef APPLESMC_GOVERNOR_H
+#define APPLESMC_GOVERNOR_H
+
+#include "smc-read.h"
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+enum class AppleSMCPriority : uint8_t {
+	Low,        // Shed as soon as the budget is half spent.
+	Normal,     // Shed once three quarters of the budget is spent.
+	High        // Only shed when the budget is exhausted.
+};
+
+/**
+ * Typical usage:
+ *  	AppleSMCGovernor governor(200, 0.01);   // At most 200 calls per second, and 1% of a CPU spent waiting on the driver.
+ *  	governor.setPriority("PC0C", AppleSMCPriority::High);
+ *  	governor.setPriority("BNum", AppleSMCPriority::Low);
+ *  	AppleSMCReader smc;
+ *  	smc.setGovernor(&governor);
+ * The budget is a pair of token buckets (one counting driver calls, the other nanoseconds spent in them), each holding 'burst' seconds worth of budget.
+ * A read that its key's priority does not allow right now is 'shed'.  AppleSMCReader::readValue then serves the key's last known value instead
+ * (which in effect stretches that key's sampling period), flagged as AppleSMCValue::cached so that consumers which need fresh readings can skip it.
+ * Every other read (and readValue, if there is no last known value yet) throws std::system_error(kIOReturnNoResources) when shed.
+ * Because lower priorities are refused while there is still budget left, the remainder is held back for higher priority keys.
+ * Full buckets admit any request whatever its priority, even one bigger than the bucket (a snapshot burst of many keys under a small budget),
+ * whose debt then paces whatever comes next.  So every read is eventually admitted, however small the budget.
+ * Time spent in the driver is the best proxy a process has for the kernel_task CPU that its SMC calls cost.
+ * Meta data lookups are never shed, but they are charged (into at most one bucket's worth of debt), so they delay everything else accordingly.
+ * Key enumeration (AppleSMCReader::allKeys, including its read of #KEY) is a one-off at startup, and is neither shed nor charged.
+ * All methods are thread safe.
+ */
+class AppleSMCGovernor {
+public:
+	struct Usage {
+		double callsPerSecond;      // Configured budget.
+		double cpuFraction;         // Configured budget.
+		double callsUsed;           // Fraction of the call bucket currently spent (may briefly exceed 1 after unconditional charges).
+		double cpuUsed;             // Fraction of the time bucket currently spent.
+		uint64_t admitted;          // Reads allowed through to the SMC.
+		uint64_t shed;              // Reads refused (served from cache, or failed).
+		uint64_t cached;            // Shed reads that were served from cache.
+	};
+
+	/**
+	 * @param callsPerSecond  Sustained driver calls per second (each key read is two calls, or one in a snapshot burst).
+	 * @param cpuFraction     Sustained fraction of one CPU that may be spent inside driver calls (1 effectively disables this limit).
+	 * @param burst           How many seconds of budget may be saved up and then spent at once.
+	 */
+	explicit AppleSMCGovernor(double callsPerSecond, double cpuFraction = 1, std::chrono::milliseconds burst = std::chrono::seconds(1));
+
+	AppleSMCGovernor(const AppleSMCGovernor& src) = delete;
+
+	AppleSMCGovernor& operator=(const AppleSMCGovernor& src) = delete;
+
+	/**
+	 * Keys default to AppleSMCPriority::Normal.
+	 */
+	void setPriority(const char* key, AppleSMCPriority priority);
+
+	Usage usage() const;
+
+	/**
+	 * Ask to make 'calls' driver calls on behalf of 'key'.  Returns false if the read should be shed.
+	 */
+	bool acquire(uint32_t key, unsigned int calls);
+
+	/**
+	 * Ask to make 'calls' driver calls on behalf of a group of keys that must be read together, at the highest priority of any of them.
+	 */
+	bool acquire(const uint32_t* keys, size_t count, unsigned int calls);
+
+	/**
+	 * Charge calls that were (or will be) made regardless of the budget.
+	 */
+	void charge(unsigned int calls);
+
+	/**
+	 * Account for time spent in the driver by admitted calls.
+	 */
+	void spent(std::chrono::steady_clock::duration elapsed);
+
+	/**
+	 * Remember the result of a successful read, so it can be served if a later read of the same key is shed.
+	 */
+	void remember(uint32_t key, const SMCKeyMetaData& meta, const SMCBytes_t buf);
+
+	/**
+	 * Retrieve a remembered read for a key whose read was shed.  Returns false if there is none.
+	 */
+	bool recall(uint32_t key, SMCKeyMetaData& meta, SMCBytes_t buf);
+
+protected:
+	struct Cached {
+		SMCKeyMetaData meta;
+		SMCBytes_t buf;
+	};
+
+	void refill(std::chrono::steady_clock::time_point now);
+
+	AppleSMCPriority priorityOf(uint32_t key) const;
+
+	bool admit(AppleSMCPriority priority, unsigned int calls);
+
+	double callRate;
+	double callCapacity;
+	double callTokens;
+	double cpuRate;         // Nanoseconds per second.
+	double cpuCapacity;
+	double cpuTokens;
+	std::chrono::steady_clock::time_point refilled;
+	uint64_t admitted;
+	uint64_t shed;
+	uint64_t cachedReads;
+	std::unordered_map<uint32_t, AppleSMCPriority> priorities;
+	std::unordered_map<uint32_t, Cached> cache;
+	mutable std::mutex lock;
+};
+
+#endif // APPLESMC_GOVERNOR_H
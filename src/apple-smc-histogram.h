@@ -0,0 +1,63 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * Bucket arithmetic for log-linear histograms of nanosecond durations.
+ */
+#ifndef APPLESMC_HISTOGRAM_H
+#define APPLESMC_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 8 linear sub-buckets per power of two (so values are accurate to ~12%), covering 0 up to ~2^62.
+ * Only the mapping between values and bucket indices lives here; callers keep their own counts (plain or atomic, as they need).
+ */
+struct AppleSMCHistogram {
+	static const size_t BUCKETS = 62 * 8;
+
+	static size_t bucketOf(uint64_t ns) {
+		if (ns < 8)
+			return static_cast<size_t>(ns);
+		int log = 63 - __builtin_clzll(ns);
+		return std::min(BUCKETS - 1, static_cast<size_t>((log - 2) * 8 + ((ns >> (log - 3)) & 7)));
+	}
+
+	/**
+	 * Lower bound of a bucket.
+	 */
+	static uint64_t valueOf(size_t bucket) {
+		if (bucket < 8)
+			return bucket;
+		int log = static_cast<int>(bucket / 8) + 2;
+		return (1ULL << log) + (static_cast<uint64_t>(bucket % 8) << (log - 3));
+	}
+};
+
+#endif // APPLESMC_HISTOGRAM_H
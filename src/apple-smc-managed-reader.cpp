@@ -0,0 +1,118 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-managed-reader.h"
+#include <algorithm>
+#include <mach/message.h>
+
+// See header for documentation
+AppleSMCManagedReader::AppleSMCManagedReader(std::chrono::milliseconds minBackoff, std::chrono::milliseconds maxBackoff) : AppleSMCReader(0), service(0), minBackoff(minBackoff), maxBackoff(std::max(minBackoff, maxBackoff)), backoff(0), lastError(kIOReturnNotOpen), openCount(0) {
+}
+
+// See header for documentation
+AppleSMCManagedReader::~AppleSMCManagedReader() {
+	// The base class closes 'conn'.
+	if (this->service != 0)
+		IOObjectRelease(this->service);
+}
+
+// See header for documentation
+void AppleSMCManagedReader::disconnect() {
+	if (this->conn != 0)
+		AppleSMCClose(this->conn);
+	this->conn = 0;
+}
+
+// See header for documentation
+bool AppleSMCManagedReader::isDeadConnection(IOReturn result) {
+	switch (result) {
+		case kIOReturnNotOpen:
+		case kIOReturnNoDevice:
+		case kIOReturnNotAttached:
+		case kIOReturnIPCError:
+		case kIOReturnOffline:
+		case kIOReturnNotResponding:
+		case kIOReturnAborted:
+		case MACH_SEND_INVALID_DEST:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Open a connection (looking up the service if we don't already have it cached).
+ * Failures are remembered, and no further attempt is made until the current backoff period has elapsed.
+ */
+IOReturn AppleSMCManagedReader::open() {
+	auto now = std::chrono::steady_clock::now();
+	if (this->backoff.count() > 0 && now < this->nextAttempt)
+		return this->lastError;
+	IOReturn result = kIOReturnNotOpen;
+	// If the cached service is stale (e.g. the driver was reloaded), look it up again and give it a second chance.
+	for (int pass = 0; pass < 2; pass++) {
+		if (this->service == 0) {
+			result = AppleSMCFindService(&this->service);
+			if (result != kIOReturnSuccess) {
+				this->service = 0;
+				break;
+			}
+		}
+		result = AppleSMCOpenService(this->service, &this->conn);
+		if (result == kIOReturnSuccess)
+			break;
+		this->conn = 0;
+		IOObjectRelease(this->service);
+		this->service = 0;
+	}
+	if (result == kIOReturnSuccess) {
+		this->openCount++;
+		this->backoff = std::chrono::milliseconds(0);
+	}
+	else {
+		this->backoff = this->backoff.count() == 0 ? this->minBackoff : std::min(this->backoff * 2, this->maxBackoff);
+		this->nextAttempt = now + this->backoff;
+	}
+	this->lastError = result;
+	return result;
+}
+
+// See header for documentation
+io_connect_t AppleSMCManagedReader::connection() {
+	if (this->conn == 0) {
+		IOReturn result = this->open();
+		if (result != kIOReturnSuccess)
+			throw std::system_error(make_error_code(result));
+	}
+	return this->conn;
+}
+
+// See header for documentation
+bool AppleSMCManagedReader::recover(IOReturn result, int attempt) {
+	if (attempt > 0 || !isDeadConnection(result))
+		return false;
+	this->disconnect();
+	return this->open() == kIOReturnSuccess;
+}
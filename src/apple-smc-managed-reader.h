@@ -0,0 +1,83 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * A self healing flavor of AppleSMCReader for long running processes.
+ */
+#ifndef APPLESMC_MANAGED_READER_H
+#define APPLESMC_MANAGED_READER_H
+
+#include "apple-smc-reader.h"
+#include <chrono>
+
+/**
+ * Drop in replacement for AppleSMCReader that:
+ *  	Does no IOKit work at all until the first read (so constructing one and never reading is free).
+ *  	Caches the AppleSMC service lookup, and only repeats it if the cached service can no longer be opened (e.g. the driver was reloaded).
+ *  	Recognizes IOReturn codes that indicate the connection itself is dead (as happens across sleep/wake), and transparently reopens and retries once.
+ *  	Backs off exponentially (from 'minBackoff' up to 'maxBackoff') between failed reopen attempts, failing fast (with the error from the last attempt) in between.
+ * Like AppleSMCReader, methods throw std::system_error when the SMC can not be read.
+ */
+class AppleSMCManagedReader : public AppleSMCReader {
+public:
+	explicit AppleSMCManagedReader(std::chrono::milliseconds minBackoff = std::chrono::milliseconds(100), std::chrono::milliseconds maxBackoff = std::chrono::seconds(30));
+
+	~AppleSMCManagedReader() override;
+
+	/**
+	 * Close the connection (if open).  The next read will reopen it.
+	 */
+	void disconnect();
+
+	/**
+	 * Number of times a connection has been (re)opened.
+	 */
+	unsigned int connects() const {
+		return this->openCount;
+	}
+
+	/**
+	 * True if 'result' means the connection (rather than the request) is broken.
+	 */
+	static bool isDeadConnection(IOReturn result);
+
+protected:
+	io_connect_t connection() override;
+
+	bool recover(IOReturn result, int attempt) override;
+
+	IOReturn open();
+
+	io_service_t service;
+	std::chrono::milliseconds minBackoff;
+	std::chrono::milliseconds maxBackoff;
+	std::chrono::milliseconds backoff;
+	std::chrono::steady_clock::time_point nextAttempt;
+	IOReturn lastError;
+	unsigned int openCount;
+};
+
+#endif // APPLESMC_MANAGED_READER_H
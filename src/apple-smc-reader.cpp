@@ -51,24 +51,150 @@ std::error_code make_error_code(IOReturn e) {
 }
 
 // See header for documentation
-AppleSMCReader::AppleSMCReader() : conn(0) {
+AppleSMCReader::AppleSMCReader() : conn(0), governor(nullptr) {
 	IOReturn result = AppleSMCOpen(&this->conn);
 	if (result != kIOReturnSuccess)
 		throw std::system_error(make_error_code(result));
 }
 
+// See header for documentation
+AppleSMCReader::AppleSMCReader(io_connect_t conn) : conn(conn), governor(nullptr) {
+}
+
 // See header for documentation
 AppleSMCReader::~AppleSMCReader() {
-	AppleSMCClose(this->conn);  // We encapsulate the connection.  Failures are ignored since this is a destructor *and* if we were destructed, this should'nt ever fail.
+	if (this->conn != 0)
+		AppleSMCClose(this->conn);  // We encapsulate the connection.  Failures are ignored since this is a destructor *and* if we were destructed, this should'nt ever fail.
 }
 
 // See header for documentation
-double AppleSMCReader::readNumber(const char* key) {
-	double retVal;
-	IOReturn result = AppleSMCReadNumber(this->conn, key, &retVal);
+io_connect_t AppleSMCReader::connection() {
+	return this->conn;
+}
+
+// See header for documentation
+bool AppleSMCReader::recover(IOReturn result, int attempt) {
+	return false;
+}
+
+// See header for documentation
+void AppleSMCReader::readKey(uint32_t key, SMCKeyMetaData& meta, SMCBytes_t buf, bool* cached) {
+	if (cached != nullptr)
+		*cached = false;
+	if (this->governor != nullptr && !this->governor->acquire(key, 2)) {
+		if (cached != nullptr && this->governor->recall(key, meta, buf)) {
+			*cached = true;
+			return;
+		}
+		throw std::system_error(make_error_code(kIOReturnNoResources));
+	}
+	auto begin = std::chrono::steady_clock::now();
+	IOReturn result;
+	for (int attempt = 0;; attempt++) {
+		result = AppleSMCReadKey(this->connection(), key, &meta, buf);
+		if (result == kIOReturnSuccess || !this->recover(result, attempt))
+			break;
+		if (this->governor != nullptr)
+			this->governor->charge(2);
+	}
+	if (this->governor != nullptr) {
+		this->governor->spent(std::chrono::steady_clock::now() - begin);
+		if (result == kIOReturnSuccess)
+			this->governor->remember(key, meta, buf);
+	}
 	if (result != kIOReturnSuccess)
 		throw std::system_error(make_error_code(result));
-	return retVal;
+}
+
+// See header for documentation
+void AppleSMCReader::readBuffer(const char* key, uint32_t* dataType, SMCBytes_t buf, uint8_t* bufLen) {
+	SMCKeyMetaData meta;
+	this->readKey(stringToKey(key), meta, buf);
+	if (dataType != nullptr)
+		*dataType = meta.dataType;
+	if (bufLen != nullptr)
+		*bufLen = static_cast<uint8_t>(meta.dataSize);
+}
+
+// See header for documentation
+void AppleSMCReader::readValue(uint32_t key, AppleSMCValue& value) {
+	SMCKeyMetaData meta;
+	SMCBytes_t buf;
+	bool cached;
+	this->readKey(key, meta, buf, &cached);
+	AppleSMCDecodeValue(meta.dataType, buf, static_cast<uint8_t>(meta.dataSize), value);
+	value.attributes = meta.dataAttributes;
+	value.cached = cached;
+}
+
+// See header for documentation
+AppleSMCValue AppleSMCReader::readValue(const char* key) {
+	AppleSMCValue value;
+	this->readValue(stringToKey(key), value);
+	return value;
+}
+
+// See header for documentation
+size_t AppleSMCReader::readBurst(size_t count, const uint32_t* keys, const SMCKeyMetaData* meta, SMCBytes_t* buffers, IOReturn* results, std::chrono::steady_clock::time_point& begin, std::chrono::steady_clock::time_point& end) {
+	size_t good = 0;
+	if (this->governor != nullptr && count > 0 && !this->governor->acquire(keys, count, static_cast<unsigned int>(count))) {
+		for (size_t i = 0; i < count; i++)
+			results[i] = kIOReturnNoResources;
+		begin = end = std::chrono::steady_clock::now();
+		return 0;
+	}
+	for (int attempt = 0;; attempt++) {
+		io_connect_t c;
+		try {
+			c = this->connection();
+		}
+		catch (const std::system_error& ex) {
+			// There is no connection to be had right now (e.g. a reopen is backing off), which fails every key rather than the burst.
+			for (size_t i = 0; i < count; i++)
+				results[i] = static_cast<IOReturn>(ex.code().value());
+			begin = end = std::chrono::steady_clock::now();
+			return 0;
+		}
+		bool restart = false;
+		good = 0;
+		begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++) {
+			results[i] = AppleSMCReadBytes(c, keys[i], meta[i].dataSize, buffers[i]);
+			if (results[i] == kIOReturnSuccess)
+				good++;
+			else if (this->recover(results[i], attempt)) {
+				// Readings from before and after a reconnect would not be a consistent snapshot, so start over.
+				restart = true;
+				break;
+			}
+			else if (this->conn != c) {
+				// Recovery gave up on the connection (and closed it), so the rest of the keys fail the same way instead of being sent on a dead handle.
+				for (size_t j = i + 1; j < count; j++)
+					results[j] = results[i];
+				break;
+			}
+		}
+		end = std::chrono::steady_clock::now();
+		if (this->governor != nullptr) {
+			this->governor->spent(end - begin);
+			if (restart)
+				this->governor->charge(static_cast<unsigned int>(count));
+		}
+		if (!restart)
+			return good;
+	}
+}
+
+// See header for documentation
+double AppleSMCReader::readNumber(const char* key) {
+	SMCBytes_t buf;
+	uint8_t bufLen;
+	uint32_t dataType;
+	this->readBuffer(key, &dataType, buf, &bufLen);
+	// The same decoding as readValue, so a key never reads differently depending on which method a poller uses.
+	AppleSMCValue value;
+	AppleSMCDecodeValue(dataType, buf, bufLen, value);
+	return value.number();
 }
 
 // See header for documentation
@@ -76,9 +202,7 @@ uint8_t AppleSMCReader::readUInt8(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (dataType != DATATYPE_UINT8_KEY && (!(dataType == DATATYPE_HEX_KEY && bufLen == 1)))
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return *reinterpret_cast<uint8_t*>(buf);
@@ -89,9 +213,7 @@ int8_t AppleSMCReader::readInt8(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (dataType != DATATYPE_SI8_KEY && (!(dataType == DATATYPE_HEX_KEY && bufLen == 1)))
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return *reinterpret_cast<int8_t*>(buf);
@@ -102,9 +224,7 @@ uint16_t AppleSMCReader::readUInt16(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (dataType != DATATYPE_UINT16_KEY && (!(dataType == DATATYPE_HEX_KEY && bufLen == 2)))
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return ntohs(*reinterpret_cast<uint16_t*>(buf));
@@ -115,9 +235,7 @@ int16_t AppleSMCReader::readInt16(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (dataType != DATATYPE_SI16_KEY && (!(dataType == DATATYPE_HEX_KEY && bufLen == 2)))
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return ntohs(*reinterpret_cast<int16_t*>(buf));
@@ -128,9 +246,7 @@ uint32_t AppleSMCReader::readUInt32(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (dataType != DATATYPE_UINT32_KEY && (!(dataType == DATATYPE_HEX_KEY && bufLen == 4)))
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return ntohl(*reinterpret_cast<uint32_t*>(buf));
@@ -141,9 +257,7 @@ float AppleSMCReader::readFloat(const char* key) {
 	SMCBytes_t buf;
 	uint8_t bufLen;
 	uint32_t dataType;
-	IOReturn result = AppleSMCReadBuffer(this->conn, key, &dataType, buf, &bufLen);
-	if (result != kIOReturnSuccess)
-		throw std::system_error(make_error_code(result));
+	this->readBuffer(key, &dataType, buf, &bufLen);
 	if (bufLen != 2)
 		throw std::system_error(make_error_code(kIOReturnBadArgument));
 	return ToSMCFloat(dataType, ntohs(*reinterpret_cast<uint16_t*>(buf)));
@@ -151,40 +265,95 @@ float AppleSMCReader::readFloat(const char* key) {
 
 // See header for documentation
 void AppleSMCReader::getKeyMetaInfo(const char* key, SMCKeyMetaData& meta) {
-	IOReturn result = AppleSMCGetKeyMetaInfo(this->conn, key, &meta);
+	if (this->governor != nullptr)
+		this->governor->charge(1);
+	IOReturn result;
+	for (int attempt = 0;; attempt++) {
+		result = AppleSMCGetKeyMetaInfo(this->connection(), key, &meta);
+		if (result == kIOReturnSuccess || !this->recover(result, attempt))
+			break;
+	}
 	if (result != kIOReturnSuccess)
 		throw std::system_error(make_error_code(result));
 }
 
 // See header for documentation
-std::vector<std::pair<std::string, double>> AppleSMCReader::allKeyValues() {
-	std::vector<std::pair<std::string, double>> retVal;
+std::vector<std::string> AppleSMCReader::allKeys() {
+	std::vector<std::string> retVal;
 	SMCKeyData inputStructure;
 	SMCKeyData outputStructure;
 	char keyBuf[5];
 	memset(&inputStructure, 0, sizeof(SMCKeyData));
 	memset(&outputStructure, 0, sizeof(SMCKeyData));
 
-	// Ask the SMC how many keys it knows about.
-	int totalKeys = this->readUInt32("#KEY");
+	// Ask the SMC how many keys it knows about (directly rather than through readUInt32, as enumeration is never subject to a governor).
+	SMCKeyMetaData meta;
+	SMCBytes_t buf;
+	IOReturn result;
+	for (int attempt = 0;; attempt++) {
+		result = AppleSMCReadKey(this->connection(), stringToKey("#KEY"), &meta, buf);
+		if (result == kIOReturnSuccess || !this->recover(result, attempt))
+			break;
+	}
+	if (result != kIOReturnSuccess)
+		throw std::system_error(make_error_code(result));
+	if (meta.dataType != DATATYPE_UINT32_KEY && !(meta.dataType == DATATYPE_HEX_KEY && meta.dataSize == 4))
+		throw std::system_error(make_error_code(kIOReturnBadArgument));
+	int totalKeys = ntohl(*reinterpret_cast<uint32_t*>(buf));
+	retVal.reserve(totalKeys);
 	for (int i = 0; i < totalKeys; i++) {
-		IOReturn result;
 		// read the name of the key we're looking for, by its ID (aka index).
 		inputStructure.data8 = SMC_CMD_READ_INDEX;
 		inputStructure.data32 = i;
-		size_t structureOutputSize = sizeof(SMCKeyData);
-		result = IOConnectCallStructMethod(this->conn, KERNEL_INDEX_SMC, &inputStructure, sizeof(SMCKeyData), &outputStructure, &structureOutputSize);
+		for (int attempt = 0;; attempt++) {
+			size_t structureOutputSize = sizeof(SMCKeyData);
+			result = IOConnectCallStructMethod(this->connection(), KERNEL_INDEX_SMC, &inputStructure, sizeof(SMCKeyData), &outputStructure, &structureOutputSize);
+			if (result == kIOReturnSuccess || !this->recover(result, attempt))
+				break;
+		}
 		if (result != kIOReturnSuccess)
 			continue;
 		// Convert the integer to human readable key.
 		keyToString(outputStructure.key, keyBuf);
+		retVal.emplace_back(keyBuf);
+	}
+	return retVal;
+}
+
+// See header for documentation
+std::vector<std::pair<std::string, double>> AppleSMCReader::allKeyValues() {
+	std::vector<std::pair<std::string, double>> retVal;
+	auto keys = this->allKeys();
+	retVal.reserve(keys.size());
+	for (auto& key : keys) {
 		// Retrieve the value of the key.
 		double value;
-		result = AppleSMCReadNumber(this->conn, keyBuf, &value);
-		if (result != kIOReturnSuccess)
+		try {
+			value = this->readNumber(key.c_str());
+		}
+		catch (const std::system_error&) {
 			value = NAN;
+		}
 		// Keep track of the key/value pair.
-		retVal.emplace_back(std::make_pair(keyBuf, value));
+		retVal.emplace_back(std::make_pair(std::move(key), value));
+	}
+	return retVal;
+}
+
+// See header for documentation
+std::vector<std::pair<std::string, AppleSMCValue>> AppleSMCReader::allValues() {
+	std::vector<std::pair<std::string, AppleSMCValue>> retVal;
+	auto keys = this->allKeys();
+	retVal.reserve(keys.size());
+	AppleSMCValue value;
+	for (auto& key : keys) {
+		try {
+			this->readValue(stringToKey(key.c_str()), value);
+		}
+		catch (const std::system_error&) {
+			continue;
+		}
+		retVal.emplace_back(std::move(key), value);
 	}
 	return retVal;
 }
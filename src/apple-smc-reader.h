@@ -31,8 +31,17 @@ SOFTWARE.
 #define APPLESMC_READER_H
 
 #include "smc-read.h"
+#include "apple-smc-value.h"
+#include "apple-smc-governor.h"
+#include <chrono>
 #include <vector>
 #include <string>
+#include <system_error>
+
+/**
+ * Wraps an IOReturn into a std::error_code (whose category maps it to a human readable message).
+ */
+std::error_code make_error_code(IOReturn e);
 
 /**
  * To use this class, simply declare an instance on the stack with:
@@ -46,24 +55,62 @@ class AppleSMCReader {
 public:
 	AppleSMCReader();
 
-	~AppleSMCReader();
+	virtual ~AppleSMCReader();
 
 	AppleSMCReader(const AppleSMCReader& src) = delete;
 
 	AppleSMCReader& operator=(const AppleSMCReader& src) = delete;
 
+	/**
+	 * Subject every subsequent read to a call budget (@see AppleSMCGovernor).  The governor is not owned, and may be shared by any number of readers.
+	 * Pass nullptr to read without limits again.
+	 */
+	void setGovernor(AppleSMCGovernor* governor) {
+		this->governor = governor;
+	}
+
+	/**
+	 * Returns the names of all keys that are available on the SMC of this machine.
+	 */
+	std::vector<std::string> allKeys();
+
 	/**
 	 * Reads all keys that are available on the SMC of this machine and returns their values.
 	 */
 	std::vector<std::pair<std::string, double>> allKeyValues();
 
+	/**
+	 * Reads all keys that are available on the SMC of this machine and returns their fully decoded values (keys that could not be read are omitted).
+	 */
+	std::vector<std::pair<std::string, AppleSMCValue>> allValues();
+
 	void getKeyMetaInfo(const char* key, SMCKeyMetaData& meta);
 
 	/**
-	 * Simple invokes @AppleSMCReadNumber
+	 * Reads and decodes a key of any data type (including its attributes), without a separate call to @getKeyMetaInfo.
+	 * This is the only read that a governor may answer from its cache, in which case AppleSMCValue::cached is set.
+	 */
+	AppleSMCValue readValue(const char* key);
+
+	/**
+	 * The same as above, but takes the key as its 32 bit code (@see stringToKey) and decodes into 'value', so repeated reads never touch the heap.
+	 */
+	void readValue(uint32_t key, AppleSMCValue& value);
+
+	/**
+	 * The numeric view of @readValue (NAN for strings and structures).  Always a fresh reading (throws kIOReturnNoResources if a governor sheds it).
 	 */
 	double readNumber(const char* key);
 
+	/**
+	 * Reads the raw bytes of 'count' keys back to back on one connection, with one driver call per key (their sizes come from 'meta', @see getKeyMetaInfo).
+	 * 'results' receives each key's status; a key that fails does not stop the burst, but if the connection has to be recovered the whole burst is repeated.
+	 * Never throws: if there is no connection (or it is lost and can not be recovered), the keys not yet read fail with the reason instead.
+	 * 'begin' and 'end' bracket the (final) burst, and nothing is allocated.  Returns the number of keys read successfully.
+	 * A governor admits (or sheds) a burst as a whole, at the highest priority of its keys; a shed burst fails every key with kIOReturnNoResources.
+	 */
+	size_t readBurst(size_t count, const uint32_t* keys, const SMCKeyMetaData* meta, SMCBytes_t* buffers, IOReturn* results, std::chrono::steady_clock::time_point& begin, std::chrono::steady_clock::time_point& end);
+
 	// If you attempt to read a specific data type from the SMC and the key is *not* of the expected dataType, an exception (std::system_error.code == kIOReturnBadArgument) will be thrown
 	uint8_t readUInt8(const char* key);
 
@@ -79,7 +126,35 @@ public:
 	float readFloat(const char* key);
 
 protected:
+	/**
+	 * For subclasses that manage the connection themselves.  The reader adopts 'conn' (which may be zero) and will close it if non-zero.
+	 */
+	explicit AppleSMCReader(io_connect_t conn);
+
+	/**
+	 * Every SMC call is made on the connection returned by this method.
+	 */
+	virtual io_connect_t connection();
+
+	/**
+	 * Called whenever an SMC call fails.  Returning true causes the call to be retried (on whatever connection() then returns).
+	 * 'attempt' is zero on the first failure of a given call.  This base class never retries.
+	 */
+	virtual bool recover(IOReturn result, int attempt);
+
+	/**
+	 * @AppleSMCReadBuffer, honoring @connection and @recover, and throwing on failure.
+	 */
+	void readBuffer(const char* key, uint32_t* dataType, SMCBytes_t buf, uint8_t* bufLen);
+
+	/**
+	 * @AppleSMCReadKey, honoring @connection, @recover and the governor (if any), and throwing on failure.
+	 * If 'cached' is not null, a read shed by the governor is answered from its cache (setting *cached) rather than failing.
+	 */
+	void readKey(uint32_t key, SMCKeyMetaData& meta, SMCBytes_t buf, bool* cached = nullptr);
+
 	io_connect_t conn;
+	AppleSMCGovernor* governor;
 };
 
 #endif // APPLESMC_READER_H
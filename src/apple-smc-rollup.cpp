@@ -0,0 +1,149 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-rollup.h"
+#include <algorithm>
+#include <cmath>
+
+static int64_t toSeconds(std::chrono::system_clock::time_point when) {
+	return std::chrono::duration_cast<std::chrono::seconds>(when.time_since_epoch()).count();
+}
+
+// Floor division, so that bucket alignment also works for times before the epoch.
+static int64_t alignDown(int64_t seconds, int64_t width) {
+	int64_t r = seconds % width;
+	return r < 0 ? seconds - r - width : seconds - r;
+}
+
+// Position of an (aligned) bucket within its ring.
+static size_t slotOf(int64_t start, const AppleSMCRollupResolution& res) {
+	int64_t slot = (start / res.seconds) % res.buckets;
+	return static_cast<size_t>(slot < 0 ? slot + res.buckets : slot);
+}
+
+// See header for documentation
+AppleSMCRollup::AppleSMCRollup(const std::vector<std::string>& keys, const std::vector<AppleSMCRollupResolution>& resolutions) : resolutions(resolutions), bucketsPerKey(0) {
+	for (auto& res : this->resolutions) {
+		res.seconds = std::max<uint32_t>(res.seconds, 1);
+		res.buckets = std::max<uint32_t>(res.buckets, 1);
+		this->offsets.push_back(this->bucketsPerKey);
+		this->bucketsPerKey += res.buckets;
+	}
+	for (auto& key : keys) {
+		uint32_t keyCode = stringToKey(key.c_str());
+		if (this->keyIndex.find(keyCode) == this->keyIndex.end())
+			this->keyIndex.emplace(keyCode, this->keyIndex.size());
+	}
+	// One allocation for everything, and it never grows.
+	this->buckets.assign(this->keyIndex.size() * this->bucketsPerKey, AppleSMCRollupBucket{-1, 0, 0, 0, 0});
+}
+
+// See header for documentation
+void AppleSMCRollup::sample(const char* key, double value, std::chrono::system_clock::time_point when) {
+	this->sample(stringToKey(key), value, when);
+}
+
+// See header for documentation
+void AppleSMCRollup::sample(uint32_t keyCode, double value, std::chrono::system_clock::time_point when) {
+	if (std::isnan(value))
+		return;
+	auto found = this->keyIndex.find(keyCode);
+	if (found == this->keyIndex.end())
+		return;
+	AppleSMCRollupBucket* block = &this->buckets[found->second * this->bucketsPerKey];
+	int64_t seconds = toSeconds(when);
+	float fvalue = static_cast<float>(value);
+	// Every resolution is updated directly from the sample (rather than from the closing of a finer bucket), so coarse buckets never lag.
+	for (size_t r = 0; r < this->resolutions.size(); r++) {
+		const auto& res = this->resolutions[r];
+		int64_t start = alignDown(seconds, res.seconds);
+		AppleSMCRollupBucket& b = block[this->offsets[r] + slotOf(start, res)];
+		if (b.start != start) {
+			if (b.start > start)
+				continue;   // Too old, this slot has already been recycled for a newer bucket.
+			b.start = start;
+			b.count = 0;
+			b.min = fvalue;
+			b.max = fvalue;
+			b.sum = 0;
+		}
+		b.count++;
+		b.sum += value;
+		if (fvalue < b.min)
+			b.min = fvalue;
+		if (fvalue > b.max)
+			b.max = fvalue;
+	}
+}
+
+/**
+ * Locate the bucket of a resolution that holds 'seconds', provided the ring still holds it.
+ */
+const AppleSMCRollupBucket* AppleSMCRollup::find(uint32_t keyCode, size_t resolution, int64_t seconds) const {
+	if (resolution >= this->resolutions.size())
+		return nullptr;
+	auto found = this->keyIndex.find(keyCode);
+	if (found == this->keyIndex.end())
+		return nullptr;
+	const auto& res = this->resolutions[resolution];
+	int64_t start = alignDown(seconds, res.seconds);
+	const AppleSMCRollupBucket& b = this->buckets[found->second * this->bucketsPerKey + this->offsets[resolution] + slotOf(start, res)];
+	return b.start == start ? &b : nullptr;
+}
+
+// See header for documentation
+const AppleSMCRollupBucket* AppleSMCRollup::bucket(const char* key, size_t resolution, std::chrono::system_clock::time_point when) const {
+	return this->find(stringToKey(key), resolution, toSeconds(when));
+}
+
+// See header for documentation
+AppleSMCRollupBucket AppleSMCRollup::query(const char* key, size_t resolution, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to) const {
+	AppleSMCRollupBucket retVal{-1, 0, NAN, NAN, 0};
+	if (resolution >= this->resolutions.size())
+		return retVal;
+	uint32_t keyCode = stringToKey(key);
+	const auto& res = this->resolutions[resolution];
+	int64_t first = alignDown(toSeconds(from), res.seconds);
+	int64_t last = toSeconds(to);
+	// A ring never holds more than 'buckets' distinct buckets, so there is no point looking further back than that.
+	first = std::max(first, alignDown(last, res.seconds) - static_cast<int64_t>(res.buckets - 1) * res.seconds);
+	for (int64_t start = first; start <= last; start += res.seconds) {
+		const AppleSMCRollupBucket* b = this->find(keyCode, resolution, start);
+		if (b == nullptr || b->count == 0)
+			continue;
+		if (retVal.count == 0) {
+			retVal.start = b->start;
+			retVal.min = b->min;
+			retVal.max = b->max;
+		}
+		else {
+			retVal.min = std::min(retVal.min, b->min);
+			retVal.max = std::max(retVal.max, b->max);
+		}
+		retVal.count += b->count;
+		retVal.sum += b->sum;
+	}
+	return retVal;
+}
@@ -0,0 +1,106 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * Downsampling of SMC samples into min/max/mean/count buckets at several resolutions (by default 1 minute and 1 hour).
+ * Everything is allocated up front, so memory is O(keys x resolutions) no matter how long the process runs.
+ */
+#ifndef APPLESMC_ROLLUP_H
+#define APPLESMC_ROLLUP_H
+
+#include "smc-read.h"
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct AppleSMCRollupBucket {
+	int64_t start;      // Seconds since the epoch (aligned to the resolution) or -1 if the bucket has never been written.
+	uint32_t count;
+	float min;
+	float max;
+	double sum;
+
+	double mean() const {
+		return count > 0 ? sum / count : NAN;
+	}
+};
+
+struct AppleSMCRollupResolution {
+	uint32_t seconds;   // Width of each bucket.
+	uint32_t buckets;   // How many buckets (history) to keep.
+};
+
+/**
+ * Typical usage:
+ *  	AppleSMCRollup rollup({"TC0P", "PC0C"});
+ *  	... every second ...
+ *  	rollup.sample("TC0P", smc.readNumber("TC0P"));
+ *  	... later ...
+ *  	auto lastHour = rollup.query("TC0P", 0, now - std::chrono::hours(1), now);
+ * Each resolution is a ring addressed directly by time ((start / seconds) % buckets), so recording a sample is O(resolutions) and
+ * a query touches at most the buckets in the requested range (never more than the ring holds).
+ * Samples older than what a ring still holds, keys that were not declared up front, and NAN values are ignored.
+ */
+class AppleSMCRollup {
+public:
+	/**
+	 * @param keys          The keys to keep history for.
+	 * @param resolutions   Finest first.  The defaults keep 1 day of minutes and 5 weeks of hours.
+	 */
+	explicit AppleSMCRollup(const std::vector<std::string>& keys, const std::vector<AppleSMCRollupResolution>& resolutions = {{60, 24 * 60}, {3600, 24 * 7 * 5}});
+
+	void sample(const char* key, double value, std::chrono::system_clock::time_point when = std::chrono::system_clock::now());
+
+	void sample(uint32_t keyCode, double value, std::chrono::system_clock::time_point when);
+
+	/**
+	 * Merge all buckets of the given resolution (index into the constructor's 'resolutions') that overlap [from, to].
+	 * The returned bucket has a count of zero if there is no data in that range.
+	 */
+	AppleSMCRollupBucket query(const char* key, size_t resolution, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to) const;
+
+	/**
+	 * Returns the bucket of the given resolution that contains 'when', or nullptr if it is not (or no longer) in memory.
+	 */
+	const AppleSMCRollupBucket* bucket(const char* key, size_t resolution, std::chrono::system_clock::time_point when) const;
+
+	size_t memoryUsed() const {
+		return this->buckets.capacity() * sizeof(AppleSMCRollupBucket);
+	}
+
+protected:
+	const AppleSMCRollupBucket* find(uint32_t keyCode, size_t resolution, int64_t seconds) const;
+
+	std::vector<AppleSMCRollupResolution> resolutions;
+	std::vector<size_t> offsets;    // Where each resolution's ring starts within a key's block of buckets.
+	size_t bucketsPerKey;
+	std::unordered_map<uint32_t, size_t> keyIndex;
+	std::vector<AppleSMCRollupBucket> buckets;
+};
+
+#endif // APPLESMC_ROLLUP_H
@@ -0,0 +1,75 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-snapshot.h"
+#include <cstring>
+
+// See header for documentation
+AppleSMCSnapshot::AppleSMCSnapshot(AppleSMCReader& reader, const std::vector<std::string>& keys) : reader(reader), names(keys), taken(0), skews{} {
+	this->keyCodes.reserve(keys.size());
+	this->meta.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		this->keyCodes.push_back(stringToKey(keys[i].c_str()));
+		this->reader.getKeyMetaInfo(keys[i].c_str(), this->meta[i]);
+	}
+	this->buffers.reset(new SMCBytes_t[keys.size()]);
+	this->results.resize(keys.size(), kIOReturnNotReady);
+	AppleSMCValue empty;
+	memset(&empty, 0, sizeof(empty));
+	this->values.resize(keys.size(), empty);
+}
+
+// See header for documentation
+size_t AppleSMCSnapshot::take() {
+	size_t good = this->reader.readBurst(this->keyCodes.size(), this->keyCodes.data(), this->meta.data(), this->buffers.get(), this->results.data(), this->burstBegin, this->burstEnd);
+	// Only now that the burst is over is there time to decode.
+	for (size_t i = 0; i < this->keyCodes.size(); i++) {
+		if (this->results[i] != kIOReturnSuccess)
+			continue;
+		AppleSMCDecodeValue(this->meta[i].dataType, this->buffers[i], static_cast<uint8_t>(this->meta[i].dataSize), this->values[i]);
+		this->values[i].attributes = this->meta[i].dataAttributes;
+	}
+	// A burst that was shed by a governor never happened, so it says nothing about skew.
+	if (good > 0) {
+		this->skews[AppleSMCHistogram::bucketOf(static_cast<uint64_t>(this->skew().count()))]++;
+		this->taken++;
+	}
+	return good;
+}
+
+// See header for documentation
+std::chrono::nanoseconds AppleSMCSnapshot::skewPercentile(double p) const {
+	uint64_t target = static_cast<uint64_t>(p * this->taken), seen = 0;
+	for (size_t i = 0; i < AppleSMCHistogram::BUCKETS; i++) {
+		seen += this->skews[i];
+		if (seen > target)
+			return std::chrono::nanoseconds(AppleSMCHistogram::valueOf(i));
+	}
+	// p >= 1 (or nothing taken yet) is the largest skew seen.
+	for (size_t i = AppleSMCHistogram::BUCKETS; i-- > 0;)
+		if (this->skews[i] != 0)
+			return std::chrono::nanoseconds(AppleSMCHistogram::valueOf(i));
+	return std::chrono::nanoseconds(0);
+}
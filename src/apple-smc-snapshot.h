@@ -0,0 +1,126 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * Reads a group of keys as close to simultaneously as the SMC allows, so that their values can be correlated.
+ */
+#ifndef APPLESMC_SNAPSHOT_H
+#define APPLESMC_SNAPSHOT_H
+
+#include "apple-smc-reader.h"
+#include "apple-smc-histogram.h"
+#include <chrono>
+#include <memory>
+
+/**
+ * Typical usage:
+ *  	AppleSMCSnapshot group(smc, {"PC0C", "TC1C", "TC2C", "F0Ac"});
+ *  	group.take();
+ *  	std::cout << group.value(0).number() << " W at " << group.value(1).number() << " C, skew " << group.skew().count() << " ns" << std::endl;
+ * The keys' meta data is resolved once, by the constructor (which throws std::system_error if any key can not be resolved).
+ * take() then issues exactly one driver call per key, back to back on a single connection, with no allocation and no decoding until the burst is over.
+ * The burst is bracketed by steady_clock timestamps, and every skew (end - begin) is recorded in a histogram for percentile reporting.
+ * Like AppleSMCReader, an instance should only be used by one thread at a time.
+ */
+class AppleSMCSnapshot {
+public:
+	AppleSMCSnapshot(AppleSMCReader& reader, const std::vector<std::string>& keys);
+
+	AppleSMCSnapshot(const AppleSMCSnapshot& src) = delete;
+
+	AppleSMCSnapshot& operator=(const AppleSMCSnapshot& src) = delete;
+
+	/**
+	 * Read every key in the group.  Returns the number of keys read successfully (@see valid).
+	 * Does not throw; if the SMC can not be reached, no key is valid (@see AppleSMCReader::readBurst).
+	 */
+	size_t take();
+
+	size_t size() const {
+		return this->keyCodes.size();
+	}
+
+	const std::string& key(size_t index) const {
+		return this->names[index];
+	}
+
+	/**
+	 * True if the key was read by the most recent take().
+	 */
+	bool valid(size_t index) const {
+		return this->results[index] == kIOReturnSuccess;
+	}
+
+	/**
+	 * The key's value as of the most recent take() (its last good value if it could not be read).
+	 */
+	const AppleSMCValue& value(size_t index) const {
+		return this->values[index];
+	}
+
+	std::chrono::steady_clock::time_point begin() const {
+		return this->burstBegin;
+	}
+
+	std::chrono::steady_clock::time_point end() const {
+		return this->burstEnd;
+	}
+
+	/**
+	 * Time between the first and last driver calls of the most recent take().
+	 */
+	std::chrono::nanoseconds skew() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(this->burstEnd - this->burstBegin);
+	}
+
+	/**
+	 * Skew below which the fraction 'p' (e.g. 0.99) of all snapshots taken so far fall.  Accurate to about 12%.
+	 */
+	std::chrono::nanoseconds skewPercentile(double p) const;
+
+	/**
+	 * Number of snapshots taken (and included in the percentiles); bursts in which no key could be read are not counted.
+	 */
+	uint64_t count() const {
+		return this->taken;
+	}
+
+protected:
+	AppleSMCReader& reader;
+	std::vector<std::string> names;
+	std::vector<uint32_t> keyCodes;
+	std::vector<SMCKeyMetaData> meta;
+	std::unique_ptr<SMCBytes_t[]> buffers;
+	std::vector<IOReturn> results;
+	std::vector<AppleSMCValue> values;
+	std::chrono::steady_clock::time_point burstBegin;
+	std::chrono::steady_clock::time_point burstEnd;
+	uint64_t taken;
+	uint64_t skews[AppleSMCHistogram::BUCKETS];
+};
+
+#endif // APPLESMC_SNAPSHOT_H
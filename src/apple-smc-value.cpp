@@ -0,0 +1,258 @@
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "apple-smc-value.h"
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+
+#pragma ide diagnostic push
+// I checked all the warnings about signed bitwise usage in this file, they are all clean so best to keep CLion happy :-)
+#pragma ide diagnostic ignored "hicpp-signed-bitwise"
+
+static uint64_t bigEndian(const SMCBytes_t buf, uint8_t len) {
+	uint64_t v = 0;
+	for (uint8_t n = 0; n < len; n++)
+		v = (v << 8) | buf[n];
+	return v;
+}
+
+static uint64_t littleEndian(const SMCBytes_t buf, uint8_t len) {
+	uint64_t v = 0;
+	for (uint8_t n = len; n > 0; n--)
+		v = (v << 8) | buf[n - 1];
+	return v;
+}
+
+typedef void (* Decoder)(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value);
+
+static void decodeBytes(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	value.kind = AppleSMCValueKind::Bytes;
+	value.u = 0;
+}
+
+static void decodeUnsigned(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	// 'scale' is the only length this type may have (zero meaning 1, 2, 4 or 8 will do, as for hex_).
+	if (scale != 0 ? len != scale : (len != 1 && len != 2 && len != 4 && len != 8))
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Unsigned;
+	value.u = bigEndian(buf, len);
+}
+
+static void decodeSigned(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != scale)
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Signed;
+	// Sign extend from however many bytes we have.
+	value.i = static_cast<int64_t>(bigEndian(buf, len) << (64 - 8 * len)) >> (64 - 8 * len);
+}
+
+static void decodeFlag(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != 1)
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Flag;
+	value.u = buf[0] != 0;
+}
+
+// fpXY: unsigned 16 bit fixed point, with Y fraction bits.
+static void decodeUnsignedFixed(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != 2)
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Real;
+	value.f = static_cast<double>(bigEndian(buf, 2)) / scale;
+}
+
+// spXY: signed 16 bit fixed point, with Y fraction bits (the sign bit is *not* included in X).
+static void decodeSignedFixed(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != 2)
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Real;
+	value.f = static_cast<int16_t>(bigEndian(buf, 2)) / scale;
+}
+
+// "flt " is an IEEE 754 single, and unlike everything else it is *little* endian (it is only found on Apple Silicon).
+static void decodeFloat(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != 4)
+		return decodeBytes(buf, len, scale, value);
+	uint32_t bits = static_cast<uint32_t>(littleEndian(buf, 4));
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	value.kind = AppleSMCValueKind::Real;
+	value.f = f;
+}
+
+// "ioft" is a little endian, unsigned 48.16 fixed point number.
+static void decodeIOFixed(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	if (len != 8)
+		return decodeBytes(buf, len, scale, value);
+	value.kind = AppleSMCValueKind::Real;
+	value.f = static_cast<double>(littleEndian(buf, 8)) / 65536.0;
+}
+
+static void decodeString(const SMCBytes_t buf, uint8_t len, double scale, AppleSMCValue& value) {
+	value.kind = AppleSMCValueKind::String;
+	value.u = strnlen(value.bytes, len);
+}
+
+struct DecoderEntry {
+	uint32_t dataType;
+	Decoder decoder;
+	double scale;
+};
+
+static constexpr DecoderEntry decoders[] = {
+	{DATATYPE_FP1F_KEY, decodeUnsignedFixed, 32768.0},
+	{DATATYPE_FP4C_KEY, decodeUnsignedFixed, 4096.0},
+	{DATATYPE_FP5B_KEY, decodeUnsignedFixed, 2048.0},
+	{DATATYPE_FP6A_KEY, decodeUnsignedFixed, 1024.0},
+	{DATATYPE_FP79_KEY, decodeUnsignedFixed, 512.0},
+	{DATATYPE_FP88_KEY, decodeUnsignedFixed, 256.0},
+	{DATATYPE_FPA6_KEY, decodeUnsignedFixed, 64.0},
+	{DATATYPE_FPC4_KEY, decodeUnsignedFixed, 16.0},
+	{DATATYPE_FPE2_KEY, decodeUnsignedFixed, 4.0},
+	{DATATYPE_SP1E_KEY, decodeSignedFixed, 16384.0},
+	{DATATYPE_SP3C_KEY, decodeSignedFixed, 4096.0},
+	{DATATYPE_SP4B_KEY, decodeSignedFixed, 2048.0},
+	{DATATYPE_SP5A_KEY, decodeSignedFixed, 1024.0},
+	{DATATYPE_SP69_KEY, decodeSignedFixed, 512.0},
+	{DATATYPE_SP78_KEY, decodeSignedFixed, 256.0},
+	{DATATYPE_SP87_KEY, decodeSignedFixed, 128.0},
+	{DATATYPE_SP96_KEY, decodeSignedFixed, 64.0},
+	{DATATYPE_SPB4_KEY, decodeSignedFixed, 16.0},
+	{DATATYPE_SPF0_KEY, decodeSignedFixed, 1.0},
+	{DATATYPE_PWM_KEY, decodeUnsignedFixed, 655.36},
+	{DATATYPE_UINT8_KEY, decodeUnsigned, 1},
+	{DATATYPE_UINT16_KEY, decodeUnsigned, 2},
+	{DATATYPE_UINT32_KEY, decodeUnsigned, 4},
+	{DATATYPE_UINT64_KEY, decodeUnsigned, 8},
+	{DATATYPE_HEX_KEY, decodeUnsigned, 0},
+	{DATATYPE_SI8_KEY, decodeSigned, 1},
+	{DATATYPE_SI16_KEY, decodeSigned, 2},
+	{DATATYPE_SI32_KEY, decodeSigned, 4},
+	{DATATYPE_SI64_KEY, decodeSigned, 8},
+	{DATATYPE_FLAG_KEY, decodeFlag, 0},
+	{DATATYPE_FLT_KEY, decodeFloat, 0},
+	{DATATYPE_IOFT_KEY, decodeIOFixed, 0},
+	{DATATYPE_CH8_KEY, decodeString, 0},
+	{DATATYPE_FDS_KEY, decodeBytes, 0},
+	{DATATYPE_REV_KEY, decodeBytes, 0},
+	{DATATYPE_LIM_KEY, decodeBytes, 0},
+	{DATATYPE_ALC_KEY, decodeBytes, 0},
+	{DATATYPE_ALV_KEY, decodeBytes, 0},
+	{DATATYPE_HDI_KEY, decodeBytes, 0}
+};
+
+// Multiplicative hash; this multiplier was found by search to map every type above to a distinct slot of a 64 entry table.
+#define DECODER_HASH_MULTIPLIER 0x1F179339u
+#define DECODER_HASH_BITS 6
+
+static constexpr uint32_t decoderSlot(uint32_t dataType) {
+	return (dataType * DECODER_HASH_MULTIPLIER) >> (32 - DECODER_HASH_BITS);
+}
+
+static constexpr bool isPerfect() {
+	for (size_t a = 0; a < sizeof(decoders) / sizeof(decoders[0]); a++)
+		for (size_t b = a + 1; b < sizeof(decoders) / sizeof(decoders[0]); b++)
+			if (decoderSlot(decoders[a].dataType) == decoderSlot(decoders[b].dataType))
+				return false;
+	return true;
+}
+
+static_assert(isPerfect(), "DECODER_HASH_MULTIPLIER must be re-searched after adding a data type");
+
+/**
+ * The table the hash indexes into, built once from 'decoders'.
+ */
+class DecoderTable {
+public:
+	DecoderTable() {
+		for (auto& slot : this->slots)
+			slot = DecoderEntry{0, decodeBytes, 0};
+		for (const auto& entry : decoders)
+			this->slots[decoderSlot(entry.dataType)] = entry;
+	}
+
+	const DecoderEntry& find(uint32_t dataType) const {
+		const DecoderEntry& entry = this->slots[decoderSlot(dataType)];
+		// A type we don't know can still land on an occupied slot, so confirm it.
+		return entry.dataType == dataType ? entry : this->unknown;
+	}
+
+private:
+	DecoderEntry slots[1 << DECODER_HASH_BITS];
+	const DecoderEntry unknown{0, decodeBytes, 0};
+};
+
+static const DecoderTable decoderTable;
+
+// See header for documentation
+void AppleSMCDecodeValue(uint32_t dataType, const SMCBytes_t buf, uint8_t bufLen, AppleSMCValue& value) {
+	if (bufLen > sizeof(SMCBytes_t))
+		bufLen = sizeof(SMCBytes_t);
+	value.dataType = dataType;
+	value.size = bufLen;
+	value.cached = false;
+	memcpy(value.bytes, buf, bufLen);
+	value.bytes[bufLen] = 0;
+	const DecoderEntry& entry = decoderTable.find(dataType);
+	entry.decoder(buf, bufLen, entry.scale, value);
+}
+
+// See header for documentation
+double AppleSMCValue::number() const {
+	switch (this->kind) {
+		case AppleSMCValueKind::Unsigned:
+		case AppleSMCValueKind::Flag:
+			return static_cast<double>(this->u);
+		case AppleSMCValueKind::Signed:
+			return static_cast<double>(this->i);
+		case AppleSMCValueKind::Real:
+			return this->f;
+		default:
+			return NAN;
+	}
+}
+
+// See header for documentation
+std::ostream& operator<<(std::ostream& os, const AppleSMCValue& value) {
+	switch (value.kind) {
+		case AppleSMCValueKind::String:
+			return os << '"' << value.bytes << '"';
+		case AppleSMCValueKind::Bytes: {
+			auto flags = os.flags();
+			auto fill = os.fill('0');
+			os << "0x" << std::noshowbase << std::hex;
+			for (uint8_t n = 0; n < value.size; n++)
+				os << std::setw(2) << static_cast<unsigned int>(static_cast<uint8_t>(value.bytes[n]));
+			os.fill(fill);
+			os.flags(flags);
+			return os;
+		}
+		default:
+			return os << value.number();
+	}
+}
+
+#pragma ide diagnostic pop
@@ -0,0 +1,79 @@
+#pragma once
+/*
+MIT License
+
+Copyright (c) 2020 Frank Stock
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/**
+ * A fixed size, heap free, tagged representation of *any* SMC value, and the decoders that produce it.
+ */
+#ifndef APPLESMC_VALUE_H
+#define APPLESMC_VALUE_H
+
+#include "smc-read.h"
+#include <ostream>
+
+enum class AppleSMCValueKind : uint8_t {
+	Unsigned,   // ui8, ui16, ui32, ui64, and hex_ of length 1, 2, 4 or 8
+	Signed,     // si8, si16, si32, si64
+	Real,       // fpXY, spXY, {pwm, flt, ioft
+	Flag,       // flag
+	String,     // ch8*
+	Bytes       // Structures ({fds, {rev, {lim, ...), odd lengths (e.g. the 5 byte ui8 MSPT), and any type we do not know.
+};
+
+/**
+ * Everything is held inline (56 bytes), so these can live on the stack or in preallocated arrays.
+ * 'bytes' always holds the raw data exactly as the SMC returned it, and is always null terminated (so for String values it *is* the string).
+ */
+struct AppleSMCValue {
+	AppleSMCValueKind kind;
+	uint8_t size;           // Number of valid bytes in 'bytes'.
+	uint8_t attributes;
+	bool cached;            // This is a governor's copy of an earlier reading (@see AppleSMCGovernor), not a fresh read.
+	uint32_t dataType;
+	union {
+		uint64_t u;
+		int64_t i;
+		double f;
+	};
+	char bytes[sizeof(SMCBytes_t) + 1];
+
+	/**
+	 * Numeric view of the value (NAN for strings and byte structures).
+	 */
+	double number() const;
+};
+
+/**
+ * Decode the raw output of the SMC.
+ * Decoders are found through a table indexed by a perfect hash of 'dataType', so this costs the same for every type.
+ */
+void AppleSMCDecodeValue(uint32_t dataType, const SMCBytes_t buf, uint8_t bufLen, AppleSMCValue& value);
+
+/**
+ * Numbers are formatted according to the stream's flags, strings are quoted, and bytes are printed in hex.
+ */
+std::ostream& operator<<(std::ostream& os, const AppleSMCValue& value);
+
+#endif // APPLESMC_VALUE_H
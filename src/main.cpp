@@ -22,19 +22,205 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include "apple-smc-reader.h"
+#include "apple-smc-managed-reader.h"
+#include "apple-smc-alerts.h"
+#include "apple-smc-energy.h"
+#include "apple-smc-fleet.h"
+#include "apple-smc-exporter.h"
+#include "apple-smc-adaptive.h"
+#include "apple-smc-snapshot.h"
+#include "apple-smc-rollup.h"
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
 #include <iostream>
+#include <memory>
 #include <iomanip>
+#include <csignal>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 
 bool cmdOptionExists(const char** begin, const char** end, const std::string& option) {
 	return std::find(begin, end, option) != end;
 }
 
-void printPair(AppleSMCReader& rdr, std::pair<std::string, double>& p) {
-	SMCKeyMetaData meta;
-	rdr.getKeyMetaInfo(p.first.c_str(), meta);
-	std::cout << p.first << " (len=" << meta.dataSize << ",attr=" << std::showbase << std::hex << (uint32_t) meta.dataAttributes << ",type=" << std::showbase << std::hex << meta.dataType << ") = " << std::dec << std::setprecision(5) << std::fixed << p.second << std::endl;
+const char* getCmdOption(const char** begin, const char** end, const std::string& option) {
+	const char** itr = std::find(begin, end, option);
+	if (itr != end && ++itr != end)
+		return *itr;
+	return nullptr;
+}
+
+void printValue(const std::string& key, const AppleSMCValue& value) {
+	std::cout << key << " (len=" << (uint32_t) value.size << ",attr=" << std::showbase << std::hex << (uint32_t) value.attributes << ",type=" << std::showbase << std::hex << value.dataType << ") = " << std::dec << std::setprecision(5) << std::fixed << value << (value.cached ? " (cached)" : "") << std::endl;
+}
+
+/**
+ * Parse a comma separated list of alert rules (e.g. "TC0P>95/90,F0Ac<500/600,PC0C~20,TC1C!4/2") into the engine.
+ */
+bool parseAlertRules(AppleSMCAlertEngine& alerts, const char* rules) {
+	std::stringstream ss(rules);
+	std::string rule;
+	while (std::getline(ss, rule, ',')) {
+		size_t op = rule.find_first_of("<>~!");
+		if (op == std::string::npos || op == 0 || op > 4)
+			return false;
+		std::string key = rule.substr(0, op);
+		const char* str = rule.c_str() + op + 1;
+		char* tail;
+		double trigger = strtod(str, &tail);
+		if (tail == str)
+			return false;
+		double clear = trigger;
+		if (*tail == '/') {
+			str = tail + 1;
+			clear = strtod(str, &tail);
+			if (tail == str)
+				return false;
+		}
+		if (*tail != 0)
+			return false;
+		switch (rule[op]) {
+			case '>':
+				alerts.addAbove(key.c_str(), trigger, clear);
+				break;
+			case '<':
+				alerts.addBelow(key.c_str(), trigger, clear);
+				break;
+			case '~':
+				alerts.addRateOfChange(key.c_str(), trigger, clear);
+				break;
+			default:
+				alerts.addAnomaly(key.c_str(), trigger, clear);
+				break;
+		}
+	}
+	return !alerts.keys().empty();
+}
+
+/**
+ * Parse "calls[/cpuPercent]" and an optional comma separated list of "KEY=low|normal|high" into a governor (nullptr if invalid).
+ */
+AppleSMCGovernor* parseBudget(const char* budget, const char* priorities) {
+	char* tail;
+	double calls = strtod(budget, &tail);
+	double cpuPercent = 100;
+	if (tail == budget || !std::isfinite(calls) || calls <= 0)
+		return nullptr;
+	if (*tail == '/') {
+		const char* str = tail + 1;
+		cpuPercent = strtod(str, &tail);
+		if (tail == str || !std::isfinite(cpuPercent) || cpuPercent <= 0)
+			return nullptr;
+	}
+	if (*tail != 0)
+		return nullptr;
+	std::unique_ptr<AppleSMCGovernor> governor(new AppleSMCGovernor(calls, cpuPercent / 100));
+	if (priorities) {
+		std::stringstream ss(priorities);
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			size_t eq = item.find('=');
+			if (eq == std::string::npos || eq == 0 || eq > 4)
+				return nullptr;
+			std::string level = item.substr(eq + 1);
+			AppleSMCPriority priority;
+			if (level == "low")
+				priority = AppleSMCPriority::Low;
+			else if (level == "normal")
+				priority = AppleSMCPriority::Normal;
+			else if (level == "high")
+				priority = AppleSMCPriority::High;
+			else
+				return nullptr;
+			governor->setPriority(item.substr(0, eq).c_str(), priority);
+		}
+	}
+	return governor.release();
+}
+
+/**
+ * True if 'str' is a whole number of milliseconds, from 0 up to INT32_MAX (about 24 days).
+ */
+bool validMillis(const char* str) {
+	char* tail;
+	errno = 0;
+	long value = strtol(str, &tail, 10);
+	return tail != str && *tail == 0 && errno == 0 && value >= 0 && value <= INT32_MAX;
+}
+
+/**
+ * Milliseconds given by an option (no less than 'minimum'), or 'defaultValue' if the option was not given.
+ * The option must already have been checked with validMillis.
+ */
+std::chrono::milliseconds millisOption(const char* value, long defaultValue, long minimum = 1) {
+	return std::chrono::milliseconds(value ? std::max(minimum, strtol(value, nullptr, 10)) : defaultValue);
+}
+
+/**
+ * Parse a TCP port number (0 meaning any free port), returning false if it is not a number in 0..65535.
+ */
+bool parsePort(const char* str, uint16_t& port) {
+	char* tail;
+	errno = 0;
+	long value = strtol(str, &tail, 10);
+	if (tail == str || *tail != 0 || errno != 0 || value < 0 || value > 65535)
+		return false;
+	port = static_cast<uint16_t>(value);
+	return true;
+}
+
+/**
+ * Split a comma separated list of keys (e.g. "PC0C,PC0G"), dropping anything that cannot be a key.
+ */
+std::vector<std::string> parseKeyList(const char* list) {
+	std::vector<std::string> keys;
+	std::stringstream ss(list);
+	std::string key;
+	while (std::getline(ss, key, ','))
+		if (!key.empty() && key.size() <= 4)
+			keys.push_back(key);
+	return keys;
+}
+
+/**
+ * Block SIGINT and SIGTERM in this thread (and so in any thread it starts afterwards), so they can be waited for or polled.
+ */
+sigset_t blockTerminationSignals() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	return signals;
+}
+
+/**
+ * Poll for a (blocked) termination signal without waiting for one.
+ */
+bool terminationPending() {
+	sigset_t pending;
+	sigpending(&pending);
+	return sigismember(&pending, SIGINT) || sigismember(&pending, SIGTERM);
+}
+
+/**
+ * Print an alert event, with the key's min/mean/max over the last hour (from 'history', if given) for context.
+ */
+void printAlert(const AppleSMCAlertEvent& e, const AppleSMCRollup* history) {
+	static const char* const kinds[] = {"above", "below", "rate", "anomaly"};
+	std::time_t now = std::time(nullptr);
+	std::cout << std::put_time(std::localtime(&now), "%FT%T") << ' ' << e.key << ' ' << kinds[static_cast<int>(e.kind)] << (e.raised ? " raised" : " cleared") << std::dec << std::setprecision(5) << std::fixed << " value=" << e.value << " metric=" << e.metric << " trigger=" << e.trigger;
+	if (history) {
+		auto to = std::chrono::system_clock::now();
+		auto hour = history->query(e.key, 0, to - std::chrono::hours(1), to);
+		if (hour.count > 0)
+			std::cout << " hour.min=" << hour.min << " hour.mean=" << hour.mean() << " hour.max=" << hour.max;
+	}
+	std::cout << std::endl;
 }
 
 int main(int argc, const char* argv[]) {
@@ -50,24 +236,330 @@ int main(int argc, const char* argv[]) {
 	else if (cmdOptionExists((const char**) argv + 1, (const char**) argv + argc, "--help"))
 		help = true;
 	bool dump = cmdOptionExists((const char**) argv + 1, (const char**) argv + argc, "--dump");
+	const char* alertRules = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--alert");
+	const char* interval = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--interval");
+	const char* maxInterval = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--max-interval");
+	const char* tolerance = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--tolerance");
+	const char* budget = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--budget");
+	const char* priorities = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--priority");
+	const char* servePort = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--serve");
+	const char* snapshotKeys = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--snapshot");
+	const char* energyKeys = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--energy");
+	const char* aggregateAddress = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--aggregate");
+	const char* pushAddress = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--push");
+	const char* fleetBench = getCmdOption((const char**) argv + 1, (const char**) argv + argc, "--fleet-bench");
+	std::unique_ptr<AppleSMCGovernor> governor;
+	if (interval && !help && !validMillis(interval)) {
+		std::cerr << "Invalid interval '" << interval << "' (milliseconds)" << std::endl;
+		return 1;
+	}
+	if (maxInterval && !help && !validMillis(maxInterval)) {
+		std::cerr << "Invalid max-interval '" << maxInterval << "' (milliseconds)" << std::endl;
+		return 1;
+	}
+	double noise = 0;
+	if (tolerance && !help) {
+		char* tail;
+		noise = strtod(tolerance, &tail);
+		if (tail == tolerance || *tail != 0 || !(noise >= 0)) {
+			std::cerr << "Invalid tolerance '" << tolerance << "'" << std::endl;
+			return 1;
+		}
+	}
+	if (budget && !help) {
+		governor.reset(parseBudget(budget, priorities));
+		if (!governor) {
+			std::cerr << "Invalid budget '" << budget << "' or priorities '" << (priorities ? priorities : "") << "'" << std::endl;
+			return 1;
+		}
+	}
 	if (help) {
 		std::string s(argv[0]);
 		std::cerr << s.substr(s.rfind('/') + 1) << ": Reads values from the Apple System Management Control (SMC) chip of this machine." << std::endl;
-		std::cerr << "Usage:  [--help] | [--dump] | *" << std::endl;
+		std::cerr << "Usage:  [--help] | [--dump] | [--alert rules [--interval ms] [--max-interval ms [--tolerance n]]] | [--serve port [--interval ms] [--max-interval ms [--tolerance n]]] | [--energy keys [--interval ms]] | [--snapshot keys [--interval ms]] | [--push address [--interval ms] [--max-interval ms [--tolerance n]]] | [--aggregate address [--interval ms]] | [--fleet-bench agents] | * [--budget calls[/cpu%] [--priority KEY=low|normal|high,...]]" << std::endl;
 		std::cerr << "--help  This usage message." << std::endl;
 		std::cerr << "--dump  Print all discoverable keys and their values." << std::endl;
+		std::cerr << "--alert  Sample keys forever, printing only alert events (with each key's min/mean/max over the last hour).  Rules are comma separated, where [/clear] sets the hysteresis level:" << std::endl;
+		std::cerr << "           KEY>high[/clear]  KEY<low[/clear]  KEY~perSecond[/clear]  KEY!zScore[/clear]" << std::endl;
+		std::cerr << "--serve  Serve Prometheus metrics for all keys at http://127.0.0.1:port/metrics" << std::endl;
+		std::cerr << "--energy  Integrate comma separated power keys (watts) until interrupted, then print the joules consumed." << std::endl;
+		std::cerr << "--snapshot  Read comma separated keys together in tight bursts until interrupted, printing each burst and its skew, then the skew percentiles." << std::endl;
+		std::cerr << "--push  Stream all keys in binary form to an aggregator (host:port, or a path for a Unix socket)." << std::endl;
+		std::cerr << "--aggregate  Accept --push streams on an address, printing a summary every interval." << std::endl;
+		std::cerr << "--fleet-bench  Measure aggregator throughput with this many simulated agents over loopback (each sending a batch every --interval ms, default flat out)." << std::endl;
+		std::cerr << "--interval  Milliseconds between samples (default 1000, or 10 for --energy)." << std::endl;
+		std::cerr << "--max-interval  Sample keys that are not changing progressively less often, but at least this often (milliseconds)." << std::endl;
+		std::cerr << "--tolerance  With --max-interval, changes no larger than this do not count as a change (default 0)." << std::endl;
+		std::cerr << "--budget  Cap SMC driver calls per second (and optionally the percentage of a CPU spent in them), serving the last known value of keys that are shed." << std::endl;
+		std::cerr << "--priority  Which keys to shed first (low) or last (high) when over --budget (default normal)." << std::endl;
 		std::cerr << "     *  One or more space separated keys (PC0C B0RM TC1C, etc.)" << std::endl;
+	} else if (servePort) {
+		uint16_t port;
+		if (!parsePort(servePort, port)) {
+			std::cerr << "Invalid port '" << servePort << "'" << std::endl;
+			return 1;
+		}
+		// Block the termination signals *before* any threads are started, so that only sigwait below sees them.
+		sigset_t signals = blockTerminationSignals();
+		AppleSMCMetricsExporter exporter(port, millisOption(interval, 1000), millisOption(maxInterval, 0, 0), noise);
+		exporter.setGovernor(governor.get());
+		exporter.start();
+		std::cerr << "Serving http://127.0.0.1:" << exporter.boundPort() << "/metrics" << std::endl;
+		int sig;
+		sigwait(&signals, &sig);
+		exporter.stop();
+	} else if (pushAddress) {
+		auto period = millisOption(interval, 1000);
+		char hostName[256];
+		if (gethostname(hostName, sizeof(hostName)) != 0)
+			strcpy(hostName, "unknown");
+		hostName[sizeof(hostName) - 1] = 0;
+		AppleSMCManagedReader rdr;
+		rdr.setGovernor(governor.get());
+		auto keys = rdr.allKeys();
+		AppleSMCFleetAgent agent(rdr, keys, hostName);
+		std::unique_ptr<AppleSMCAdaptiveSampler> adaptive;
+		if (maxInterval)
+			adaptive.reset(new AppleSMCAdaptiveSampler(rdr, keys, period, millisOption(maxInterval, 0, 0), noise));
+		auto next = std::chrono::steady_clock::now();
+		for (;;) {
+			try {
+				agent.connect(pushAddress);
+				for (;;) {
+					if (adaptive) {
+						adaptive->poll([&agent](size_t index, uint32_t key, double value) {
+							if (!std::isnan(value))
+								agent.add(key, value);
+						});
+						agent.flush();
+						next = adaptive->nextDue();
+					} else {
+						agent.sample();
+						agent.flush();
+						next += period;
+					}
+					std::this_thread::sleep_until(next);
+				}
+			}
+			catch (const std::system_error& ex) {
+				std::cerr << "Error pushing to '" << pushAddress << "' : " << ex.what() << std::endl;
+			}
+			// Try again after a while.
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+			next = std::chrono::steady_clock::now();
+		}
+	} else if (aggregateAddress) {
+		auto period = millisOption(interval, 10000);
+		AppleSMCFleetAggregator aggregator;
+		std::string bound;
+		try {
+			bound = aggregator.listen(aggregateAddress);
+		}
+		catch (const std::system_error& ex) {
+			std::cerr << "Error listening on '" << aggregateAddress << "' : " << ex.what() << std::endl;
+			return 1;
+		}
+		std::cerr << "Aggregating on " << bound << std::endl;
+		std::thread loop(&AppleSMCFleetAggregator::run, &aggregator);
+		for (;;) {
+			std::this_thread::sleep_for(period);
+			auto stats = aggregator.stats();
+			std::cout << "hosts=" << aggregator.hosts().size() << " connections=" << stats.connections << " frames=" << stats.frames << " samples=" << stats.samples << " bytes=" << stats.bytes << " errors=" << stats.errors << std::endl;
+		}
+	} else if (fleetBench) {
+		// N simulated agents, each with 256 synthetic keys, push a batch every --interval ms (or as fast as they can) for a few seconds.
+		const int agents = std::max(1, atoi(fleetBench));
+		const auto period = millisOption(interval, 0, 0);
+		std::atomic<uint64_t> offered(0);
+		const int keysPerAgent = 256;
+		const auto duration = std::chrono::seconds(5);
+		AppleSMCFleetAggregator aggregator;
+		std::string address = aggregator.listen("127.0.0.1:0");
+		std::thread loop(&AppleSMCFleetAggregator::run, &aggregator);
+		std::atomic<bool> go(true);
+		std::vector<std::thread> senders;
+		for (int a = 0; a < agents; a++) {
+			senders.emplace_back([&, a]() {
+				try {
+					int fd = AppleSMCFleetConnect(address);
+					AppleSMCFleetEncoder encoder(keysPerAgent);
+					encoder.hello("agent-" + std::to_string(a));
+					auto& hello = encoder.finish();
+					AppleSMCFleetSend(fd, hello.data(), hello.size());
+					uint64_t timestamp = 0;
+					auto next = std::chrono::steady_clock::now();
+					while (go) {
+						encoder.clear();
+						timestamp++;
+						for (uint32_t k = 0; k < keysPerAgent; k++)
+							encoder.add(0x54000000 + k, timestamp, static_cast<double>(k) + timestamp);
+						auto& out = encoder.finish();
+						AppleSMCFleetSend(fd, out.data(), out.size());
+						offered += keysPerAgent;
+						if (period.count() > 0) {
+							// A real agent that falls behind skips samples rather than bursting to catch up.
+							next = std::max(next + period, std::chrono::steady_clock::now());
+							std::this_thread::sleep_until(next);
+						}
+					}
+					close(fd);
+				}
+				catch (const std::system_error& ex) {
+					std::cerr << "Agent " << a << " : " << ex.what() << std::endl;
+				}
+			});
+		}
+		auto begin = std::chrono::steady_clock::now();
+		std::this_thread::sleep_for(duration);
+		auto stats = aggregator.stats();
+		uint64_t sent = offered;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		go = false;
+		for (auto& t : senders)
+			t.join();
+		aggregator.stop();
+		loop.join();
+		std::cout << agents << " agents, " << std::setprecision(0) << std::fixed << sent / seconds << " samples/s offered, " << stats.samples / seconds << " samples/s merged, " << stats.frames / seconds << " frames/s, " << std::setprecision(1) << stats.bytes / seconds / 1048576 << " MiB/s, hosts=" << aggregator.hosts().size() << ", errors=" << stats.errors << std::endl;
+	} else if (snapshotKeys) {
+		auto keys = parseKeyList(snapshotKeys);
+		blockTerminationSignals();
+		AppleSMCManagedReader rdr;
+		rdr.setGovernor(governor.get());
+		std::unique_ptr<AppleSMCSnapshot> group;
+		try {
+			group.reset(new AppleSMCSnapshot(rdr, keys));
+		}
+		catch (const std::system_error& ex) {
+			std::cerr << "Error resolving keys '" << snapshotKeys << "' : " << ex.what() << std::endl;
+			return 1;
+		}
+		AppleSMCSnapshot& snapshot = *group;
+		auto period = millisOption(interval, 1000);
+		auto next = std::chrono::steady_clock::now();
+		std::cout << std::setprecision(5) << std::fixed;
+		for (;;) {
+			try {
+				snapshot.take();
+			}
+			catch (const std::exception& ex) {
+				// take() reports an unreachable SMC as unreadable keys, but nothing should end a long running loop.
+				std::cerr << "Error taking snapshot : " << ex.what() << std::endl;
+			}
+			for (size_t i = 0; i < snapshot.size(); i++) {
+				std::cout << snapshot.key(i) << '=';
+				if (snapshot.valid(i))
+					std::cout << snapshot.value(i) << ' ';
+				else
+					std::cout << "? ";
+			}
+			std::cout << "skew=" << snapshot.skew().count() / 1000.0 << "us" << std::endl;
+			if (terminationPending())
+				break;
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+		std::cout << snapshot.count() << " snapshots, skew p50=" << snapshot.skewPercentile(0.5).count() / 1000.0 << "us p99=" << snapshot.skewPercentile(0.99).count() / 1000.0
+				<< "us p99.9=" << snapshot.skewPercentile(0.999).count() / 1000.0 << "us max=" << snapshot.skewPercentile(1).count() / 1000.0 << "us" << std::endl;
+	} else if (energyKeys) {
+		auto keys = parseKeyList(energyKeys);
+		blockTerminationSignals();
+		AppleSMCManagedReader rdr;
+		rdr.setGovernor(governor.get());
+		std::unique_ptr<AppleSMCEnergyMeter> energy;
+		try {
+			energy.reset(new AppleSMCEnergyMeter(rdr, keys));
+		}
+		catch (const std::system_error& ex) {
+			std::cerr << "Error resolving keys '" << energyKeys << "' : " << ex.what() << std::endl;
+			return 1;
+		}
+		AppleSMCEnergyMeter& meter = *energy;
+		auto period = millisOption(interval, 10);
+		auto next = std::chrono::steady_clock::now();
+		for (;;) {
+			try {
+				meter.sample();
+			}
+			catch (const std::exception& ex) {
+				// Unreadable keys are already counted as gaps by the meter, but nothing should end a long running loop.
+				std::cerr << "Error sampling energy : " << ex.what() << std::endl;
+			}
+			if (terminationPending())
+				break;
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+		for (auto& k : meter.keys()) {
+			auto e = meter.total(k.c_str());
+			std::cout << k << " = " << std::setprecision(5) << std::fixed << e.joules << " J (+/- " << e.uncertainty << " J over " << e.seconds << " s, avg " << (e.seconds > 0 ? e.joules / e.seconds : 0) << " W, " << e.gaps << " gaps)" << std::endl;
+		}
+	} else if (alertRules) {
+		// The rollup can only be sized once the rules (and so the keys) are known, but the engine's callback is fixed at construction.
+		std::unique_ptr<AppleSMCRollup> history;
+		AppleSMCAlertEngine alerts([&history](const AppleSMCAlertEvent& e) {
+			printAlert(e, history.get());
+		});
+		if (!parseAlertRules(alerts, alertRules)) {
+			std::cerr << "Invalid alert rules '" << alertRules << "'" << std::endl;
+			return 1;
+		}
+		auto period = millisOption(interval, 1000);
+		AppleSMCManagedReader rdr;
+		rdr.setGovernor(governor.get());
+		char keyBuf[5];
+		std::vector<std::string> keys;
+		for (auto keyCode : alerts.keys()) {
+			keyToString(keyCode, keyBuf);
+			keys.emplace_back(keyBuf);
+		}
+		history.reset(new AppleSMCRollup(keys));
+		if (maxInterval) {
+			AppleSMCAdaptiveSampler adaptive(rdr, keys, period, millisOption(maxInterval, 0, 0), noise);
+			for (;;) {
+				adaptive.poll([&alerts, &history](size_t index, uint32_t key, double value) {
+					if (!std::isnan(value)) {
+						history->sample(key, value, std::chrono::system_clock::now());
+						alerts.sample(key, value, std::chrono::steady_clock::now());
+					}
+				});
+				std::this_thread::sleep_until(adaptive.nextDue());
+			}
+		}
+		auto next = std::chrono::steady_clock::now();
+		for (;;) {
+			for (auto keyCode : alerts.keys()) {
+				keyToString(keyCode, keyBuf);
+				try {
+					// A governor's cached copy of an earlier reading would look like a signal that has stopped changing, so only fresh readings are sampled.
+					AppleSMCValue value;
+					rdr.readValue(keyCode, value);
+					if (!value.cached) {
+						history->sample(keyCode, value.number(), std::chrono::system_clock::now());
+						alerts.sample(keyCode, value.number(), std::chrono::steady_clock::now());
+					}
+				}
+				catch (const std::exception& ex) {
+					std::cerr << "Error processing key '" << keyBuf << "' : " << ex.what() << std::endl;
+				}
+			}
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
 	} else if (dump) {
 		AppleSMCReader rdr;
-		for (auto p : rdr.allKeyValues())
-			printPair(rdr, p);
+		rdr.setGovernor(governor.get());
+		for (auto& p : rdr.allValues())
+			printValue(p.first, p.second);
 	} else {
 		AppleSMCReader rdr;
+		rdr.setGovernor(governor.get());
 		for (int i = 1; i < argc; i++) {
+			// The values of --budget and --priority are not keys.
+			if (strcmp(argv[i - 1], "--budget") == 0 || strcmp(argv[i - 1], "--priority") == 0)
+				continue;
 			if (strlen(argv[i]) <= 4) {
 				try {
-					auto p = std::make_pair(std::string(argv[i]), rdr.readNumber(argv[i]));
-					printPair(rdr, p);
+					printValue(argv[i], rdr.readValue(argv[i]));
 				}
 				catch (const std::exception& ex) {
 					std::cerr << "Error processing key '" << argv[i] << "' : " << ex.what() << std::endl;
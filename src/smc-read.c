@@ -52,11 +52,11 @@ void keyToString(uint32_t key, char* str) {
 }
 
 // See header for documentation
-IOReturn AppleSMCOpen(io_connect_t* conn) {
-	if (conn == NULL)
+IOReturn AppleSMCFindService(io_service_t* service) {
+	if (service == NULL)
 		return kIOReturnInvalid;
 	io_iterator_t existing;
-	*conn = 0;
+	*service = 0;
 	// Create a matching dictionary that specifies an IOService class match.
 	CFMutableDictionaryRef matching = IOServiceMatching("AppleSMC");
 	// Look up registered IOService objects that match a matching dictionary.
@@ -64,13 +64,33 @@ IOReturn AppleSMCOpen(io_connect_t* conn) {
 	if (result != kIOReturnSuccess)
 		return result;
 	// Returns the next object in an iteration.
-	io_object_t service = IOIteratorNext(existing);
+	*service = IOIteratorNext(existing);
 	// Releases an object handle previously returned by IOKitLib.
 	IOObjectRelease(existing);
-	if (service == 0)
+	if (*service == 0)
 		return kIOReturnNotFound;
+	return kIOReturnSuccess;
+}
+
+// See header for documentation
+IOReturn AppleSMCOpenService(io_service_t service, io_connect_t* conn) {
+	if (conn == NULL)
+		return kIOReturnInvalid;
+	*conn = 0;
 	// A request to create a connection to an IOService.
-	result = IOServiceOpen(service, mach_task_self(), 0, conn);
+	return IOServiceOpen(service, mach_task_self(), 0, conn);
+}
+
+// See header for documentation
+IOReturn AppleSMCOpen(io_connect_t* conn) {
+	if (conn == NULL)
+		return kIOReturnInvalid;
+	*conn = 0;
+	io_service_t service;
+	IOReturn result = AppleSMCFindService(&service);
+	if (result != kIOReturnSuccess)
+		return result;
+	result = AppleSMCOpenService(service, conn);
 	// Releases an object handle previously returned by IOKitLib.
 	IOObjectRelease(service);
 	return result;
@@ -83,7 +103,7 @@ IOReturn AppleSMCClose(io_connect_t conn) {
 }
 
 // See header for documentation
-IOReturn AppleSMCReadBuffer(io_connect_t conn, const char* key, uint32_t* dataType, SMCBytes_t buff, uint8_t* buffLen) {
+IOReturn AppleSMCReadKey(io_connect_t conn, uint32_t key, SMCKeyMetaData* meta, SMCBytes_t buff) {
 	SMCKeyData inputStructure;
 	SMCKeyData outputStructure;
 
@@ -92,16 +112,14 @@ IOReturn AppleSMCReadBuffer(io_connect_t conn, const char* key, uint32_t* dataTy
 	memset(&outputStructure, 0, sizeof(SMCKeyData));
 
 	// Send a command to retrieve information about the key (specifically it's dataType and size).
-	inputStructure.key = stringToKey(key);
+	inputStructure.key = key;
 	inputStructure.data8 = SMC_CMD_READ_KEYINFO;
 	size_t structureOutputSize = sizeof(SMCKeyData);
 	IOReturn result = IOConnectCallStructMethod(conn, KERNEL_INDEX_SMC, &inputStructure, sizeof(SMCKeyData), &outputStructure, &structureOutputSize);
 	if (result != kIOReturnSuccess)
 		return result;
-	if (dataType != NULL)
-		*dataType = outputStructure.keyInfo.dataType;
-	if (buffLen != NULL)
-		*buffLen = outputStructure.keyInfo.dataSize;
+	if (meta != NULL)
+		memcpy(meta, &outputStructure.keyInfo, sizeof(SMCKeyMetaData));
 
 	// Send another command to retrieve the actual key value.
 	inputStructure.keyInfo.dataSize = outputStructure.keyInfo.dataSize;
@@ -116,6 +134,36 @@ IOReturn AppleSMCReadBuffer(io_connect_t conn, const char* key, uint32_t* dataTy
 	return kIOReturnSuccess;
 }
 
+// See header for documentation
+IOReturn AppleSMCReadBytes(io_connect_t conn, uint32_t key, uint32_t dataSize, SMCBytes_t buff) {
+	SMCKeyData inputStructure;
+	SMCKeyData outputStructure;
+
+	memset(&inputStructure, 0, sizeof(SMCKeyData));
+	inputStructure.key = key;
+	inputStructure.keyInfo.dataSize = dataSize;
+	inputStructure.data8 = SMC_CMD_READ_BYTES;
+	size_t structureOutputSize = sizeof(SMCKeyData);
+	IOReturn result = IOConnectCallStructMethod(conn, KERNEL_INDEX_SMC, &inputStructure, sizeof(SMCKeyData), &outputStructure, &structureOutputSize);
+	if (result != kIOReturnSuccess)
+		return result;
+	memcpy(buff, outputStructure.bytes, sizeof(outputStructure.bytes));
+	return kIOReturnSuccess;
+}
+
+// See header for documentation
+IOReturn AppleSMCReadBuffer(io_connect_t conn, const char* key, uint32_t* dataType, SMCBytes_t buff, uint8_t* buffLen) {
+	SMCKeyMetaData meta;
+	IOReturn result = AppleSMCReadKey(conn, stringToKey(key), &meta, buff);
+	if (result != kIOReturnSuccess)
+		return result;
+	if (dataType != NULL)
+		*dataType = meta.dataType;
+	if (buffLen != NULL)
+		*buffLen = meta.dataSize;
+	return kIOReturnSuccess;
+}
+
 // See header for documentation
 IOReturn AppleSMCGetKeyMetaInfo(io_connect_t conn, const char* key, SMCKeyMetaData* meta) {
 	SMCKeyData inputStructure;
@@ -138,118 +186,149 @@ IOReturn AppleSMCGetKeyMetaInfo(io_connect_t conn, const char* key, SMCKeyMetaDa
 	return kIOReturnSuccess;
 }
 
-// See header for documentation
-float ToSMCFloat(uint32_t dataType, uint16_t value) {
-	float result = value;
+/**
+ * Divisor that converts the raw 16 bit value of an fpXY, spXY or {pwm key into a number, or zero if 'dataType' is none of those.
+ * These are the same scales as the decoder table in apple-smc-value.cpp.
+ */
+static double fixedPointScale(uint32_t dataType) {
 	switch (dataType) {
 		case DATATYPE_FP1F_KEY:
-			result /= 32768.0f;
-			break;
+			return 32768.0;
 		case DATATYPE_FP4C_KEY:
-			result /= 4096.0f;
-			break;
+			return 4096.0;
 		case DATATYPE_FP5B_KEY:
-			result /= 2048.0f;
-			break;
+			return 2048.0;
 		case DATATYPE_FP6A_KEY:
-			result /= 1024.0f;
-			break;
+			return 1024.0;
 		case DATATYPE_FP79_KEY:
-			result /= 512.0f;
-			break;
+			return 512.0;
 		case DATATYPE_FP88_KEY:
-			result /= 256.0f;
-			break;
+			return 256.0;
 		case DATATYPE_FPA6_KEY:
-			result /= 64.0f;
-			break;
+			return 64.0;
 		case DATATYPE_FPC4_KEY:
-			result /= 16.0f;
-			break;
+			return 16.0;
 		case DATATYPE_FPE2_KEY:
-			result /= 4.0f;
-			break;
+			return 4.0;
 
 		case DATATYPE_SP1E_KEY:
-			result /= 16384.0f;
-			break;
+			return 16384.0;
 		case DATATYPE_SP3C_KEY:
-			result /= 4096.0f;
-			break;
+			return 4096.0;
 		case DATATYPE_SP4B_KEY:
-			result /= 2048.0f;
-			break;
+			return 2048.0;
 		case DATATYPE_SP5A_KEY:
-			result /= 1024.0f;
-			break;
+			return 1024.0;
 		case DATATYPE_SP69_KEY:
-			result /= 512.0f;
-			break;
+			return 512.0;
 		case DATATYPE_SP78_KEY:
-			result /= 256.0f;
-			break;
+			return 256.0;
 		case DATATYPE_SP87_KEY:
-			result /= 128.0f;
-			break;
+			return 128.0;
 		case DATATYPE_SP96_KEY:
-			result /= 64.0f;
-			break;
+			return 64.0;
 		case DATATYPE_SPB4_KEY:
-			result /= 16.0f;
-			break;
+			return 16.0;
 		case DATATYPE_SPF0_KEY:
-			// is / 1.0;
-			break;
+			return 1.0;
 
 		case DATATYPE_PWM_KEY:
-			result /= 655.36f;
-			break;
+			return 655.36;
 
 		default:
-			// Oops!
-			result = NAN;
+			return 0;
 	}
-	return result;
+}
+
+/**
+ * The raw 16 bit value of a fixed point key, converted with 'scale' (@see fixedPointScale).
+ */
+static double fixedPointValue(uint32_t dataType, uint16_t value, double scale) {
+	// The spXY types are two's complement (the sign bit is *not* included in X).
+	if ((dataType & 0xFFFF0000) == 0x73700000)   // "sp.."
+		return (int16_t) value / scale;
+	return value / scale;
+}
+
+/**
+ * Unsigned integer from the first 'len' bytes of 'buf', which are big endian (the SMC's own order) unless 'little' is set ("flt " and "ioft").
+ */
+static uint64_t unsignedValue(const SMCBytes_t buf, uint8_t len, int little) {
+	uint64_t v = 0;
+	for (uint8_t n = 0; n < len; n++)
+		v = (v << 8) | (uint8_t) buf[little ? len - 1 - n : n];
+	return v;
+}
+
+// See header for documentation
+float ToSMCFloat(uint32_t dataType, uint16_t value) {
+	double scale = fixedPointScale(dataType);
+	if (scale == 0)
+		return NAN;
+	return (float) fixedPointValue(dataType, value, scale);
 }
 
 // See header for documentation
 double ToSMCNumber(uint32_t dataType, const SMCBytes_t buf, uint8_t bufLen) {
+	double scale = fixedPointScale(dataType);
+	if (scale != 0)
+		return bufLen == 2 ? fixedPointValue(dataType, (uint16_t) unsignedValue(buf, 2, 0), scale) : NAN;
 	switch (dataType) {
 		case DATATYPE_HEX_KEY:
 			// Hex keys vary in length, but 1,2,4,8 are just numbers.
-			switch (bufLen) {
-				case 1:
-					return *((uint8_t*) buf);
-				case 2:
-					return ntohs(*((uint16_t*) buf));
-				case 4:
-					return ntohl(*((uint32_t*) buf));
-				default:
-					return NAN;
-			}
-		case DATATYPE_UINT8_KEY:
+			if (bufLen != 1 && bufLen != 2 && bufLen != 4 && bufLen != 8)
+				return NAN;
+			return (double) unsignedValue(buf, bufLen, 0);
 		case DATATYPE_FLAG_KEY:
 			if (bufLen != 1)
 				return NAN;
-			return *((uint8_t*) buf);
+			return buf[0] != 0;
+		case DATATYPE_UINT8_KEY:
+			if (bufLen != 1)
+				return NAN;
+			return (double) unsignedValue(buf, 1, 0);
 		case DATATYPE_SI8_KEY:
 			if (bufLen != 1)
 				return NAN;
-			return *((int8_t*) buf);
+			return (int8_t) unsignedValue(buf, 1, 0);
 		case DATATYPE_UINT16_KEY:
 			if (bufLen != 2)
 				return NAN;
-			return ntohs(*((uint16_t*) buf));
+			return (double) unsignedValue(buf, 2, 0);
 		case DATATYPE_SI16_KEY:
 			if (bufLen != 2)
 				return NAN;
-			return ntohs(*((int16_t*) buf));
+			return (int16_t) unsignedValue(buf, 2, 0);
 		case DATATYPE_UINT32_KEY:
 			if (bufLen != 4)
 				return NAN;
-			return ntohl(*((uint32_t*) buf));
+			return (double) unsignedValue(buf, 4, 0);
+		case DATATYPE_SI32_KEY:
+			if (bufLen != 4)
+				return NAN;
+			return (int32_t) unsignedValue(buf, 4, 0);
+		case DATATYPE_UINT64_KEY:
+			if (bufLen != 8)
+				return NAN;
+			return (double) unsignedValue(buf, 8, 0);
+		case DATATYPE_SI64_KEY:
+			if (bufLen != 8)
+				return NAN;
+			return (double) (int64_t) unsignedValue(buf, 8, 0);
+		case DATATYPE_FLT_KEY: {
+			if (bufLen != 4)
+				return NAN;
+			uint32_t bits = (uint32_t) unsignedValue(buf, 4, 1);
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			return f;
+		}
+		case DATATYPE_IOFT_KEY:
+			if (bufLen != 8)
+				return NAN;
+			return (double) unsignedValue(buf, 8, 1) / 65536.0;
 		default:
-			return ToSMCFloat(dataType, ntohs(*((uint16_t*) buf)));
+			return NAN;
 	}
 }
 
@@ -58,14 +58,28 @@ extern "C" {
 #define DATATYPE_UINT8_KEY 0x75693820   // "ui8 "
 #define DATATYPE_UINT16_KEY 0x75693136  // "ui16"
 #define DATATYPE_UINT32_KEY 0x75693332  // "ui32"
+#define DATATYPE_UINT64_KEY 0x75693634  // "ui64"
 
 #define DATATYPE_SI8_KEY 0x73693820     // "si8 "
 #define DATATYPE_SI16_KEY 0x73693136    // "si16"
+#define DATATYPE_SI32_KEY 0x73693332    // "si32"
+#define DATATYPE_SI64_KEY 0x73693634    // "si64"
 
 #define DATATYPE_PWM_KEY 0x7B70776D     // "{pwm"
 #define DATATYPE_FLAG_KEY 0x666C6167    // "flag"
 #define DATATYPE_HEX_KEY 0x6865785F     // "hex_"
 
+// These are not numbers (or at least not the big endian integers / fixed point numbers above), see apple-smc-value.h for how they are decoded.
+#define DATATYPE_FLT_KEY 0x666C7420     // "flt "
+#define DATATYPE_IOFT_KEY 0x696F6674    // "ioft"
+#define DATATYPE_CH8_KEY 0x6368382A     // "ch8*"
+#define DATATYPE_FDS_KEY 0x7B666473     // "{fds"
+#define DATATYPE_REV_KEY 0x7B726576     // "{rev"
+#define DATATYPE_LIM_KEY 0x7B6C696D     // "{lim"
+#define DATATYPE_ALC_KEY 0x7B616C63     // "{alc"
+#define DATATYPE_ALV_KEY 0x7B616C76     // "{alv"
+#define DATATYPE_HDI_KEY 0x7B686469     // "{hdi"
+
 uint32_t stringToKey(const char* str);
 
 void keyToString(uint32_t key, char* str);
@@ -128,6 +142,23 @@ typedef struct {
  */
 IOReturn AppleSMCOpen(io_connect_t* conn);
 
+/**
+ * The first half of @see AppleSMCOpen, for callers that want to cache the (relatively expensive) service lookup across reconnects.
+ *
+ * @param service   Set to the AppleSMC service on success.  The caller owns this reference and must eventually IOObjectRelease it.
+ * @return          kIOReturnSuccess if the service was found, some other error if not.
+ */
+IOReturn AppleSMCFindService(io_service_t* service);
+
+/**
+ * The second half of @see AppleSMCOpen, opening a connection to a service located by @see AppleSMCFindService
+ *
+ * @param service   The AppleSMC service (still owned by the caller).
+ * @param conn      Reference to a connection handle used to communicate with the SMC.  This value is undefined if the connection was not opened successfully.
+ * @return          kIOReturnSuccess if the connection was opened successfully, some other error if not.
+ */
+IOReturn AppleSMCOpenService(io_service_t service, io_connect_t* conn);
+
 /**
  * Read the numeric value of a key from the SMC.
  *
@@ -170,13 +201,25 @@ IOReturn AppleSMCGetKeyMetaInfo(io_connect_t conn, const char* key, SMCKeyMetaDa
 IOReturn AppleSMCReadBuffer(io_connect_t conn, const char* key, uint32_t* dataType, SMCBytes_t buff, uint8_t* buffLen);
 
 /**
- * Decimal values are read from the SMC as 16 bit unsigned integers that are then converted to decimal based to the 'dataType'.
+ * The same as @see AppleSMCReadBuffer, but takes the key as its 32 bit code (@see stringToKey) and returns all of the key's meta data (including its attributes).
+ */
+IOReturn AppleSMCReadKey(io_connect_t conn, uint32_t key, SMCKeyMetaData* meta, SMCBytes_t buff);
+
+/**
+ * Reads the value of a key whose size is already known (@see AppleSMCGetKeyMetaInfo), with a single call into the driver instead of two.
+ */
+IOReturn AppleSMCReadBytes(io_connect_t conn, uint32_t key, uint32_t dataSize, SMCBytes_t buff);
+
+/**
+ * Decimal values are read from the SMC as 16 bit integers (unsigned for fpXY, signed for spXY) that are then converted to decimal based to the 'dataType'.
  * This function performs that conversion and is exposed for scenarios where you might need to use @AppleSMCReadBuffer
  */
 float ToSMCFloat(uint32_t dataType, uint16_t value);
 
 /**
  * This function is exposed for scenarios where you might need to use @AppleSMCReadBuffer
+ * It applies the same rules as AppleSMCDecodeValue (apple-smc-value.h) and AppleSMCValue::number, so the C and C++ APIs read every key as the same number:
+ * each type must have its expected length, a flag is 0 or 1, and strings, structures, unknown types and wrong lengths are NAN.
  */
 double ToSMCNumber(uint32_t dataType, const SMCBytes_t buf, uint8_t bufLen);
 